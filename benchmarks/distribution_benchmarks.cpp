@@ -17,6 +17,7 @@ void ScatterGatherNopTest(int argc, char **argv) {
     timer.next("Start experiment");
     ScatterGather<Type> scatter_gather;
     auto files = FindFiles(input_prefix);
+    GetFileInfo(files);
     ScatterGatherConfig config;
     config.bucketed_writer_config.num_buckets = num_buckets;
     config.benchmark_mode = true;
@@ -69,32 +69,41 @@ void InMemoryPermutationTest(int argc, char **argv) {
     timer.next("parlay::permutation DONE");
 }
 
-void InMemoryReduceTest(int argc, char **argv) {
+double InMemoryReduceTime(size_t n) {
     using T = uint64_t;
-    CHECK(argc > 2) << "Expected number of elements to reduce";
-    const size_t n = 1UL << strtol(argv[2], nullptr, 10);
     auto sequence = RandomSequence<T>(n);
     parlay::internal::timer timer("In memory reduce");
     timer.next("Start reduce");
     parlay::monoid monoid([](T a, T b) { return a ^ b; }, 0);
-    [[maybe_unused]] auto result = parlay::reduce(sequence, monoid);
-    double time = timer.next_time();
-    double throughput = GetThroughput(n * sizeof(T), time);
-    std::cout << "Throughput: " << throughput << "GB\n";
-    std::cout << "DONE: " << time << '\n';
+    // volatile, so the reduction is not optimized away
+    [[maybe_unused]] volatile auto result = parlay::reduce(sequence, monoid);
+    return timer.next_time();
 }
 
-void InMemoryMapTest(int argc, char **argv) {
+double InMemoryMapTime(size_t n) {
     using T = uint64_t;
-    CHECK(argc > 2) << "Expected number of elements to map";
-    const size_t n = 1UL << strtol(argv[2], nullptr, 10);
     auto sequence = RandomSequence<T>(n);
     parlay::internal::timer timer("In memory map");
     timer.next("Start map");
     [[maybe_unused]]
     auto result = parlay::map(sequence, [](T num) { return num / 2; });
-    double time = timer.next_time();
-    double throughput = GetThroughput(n * sizeof(T), time);
+    return timer.next_time();
+}
+
+void InMemoryReduceTest(int argc, char **argv) {
+    CHECK(argc > 2) << "Expected number of elements to reduce";
+    const size_t n = 1UL << strtol(argv[2], nullptr, 10);
+    double time = InMemoryReduceTime(n);
+    double throughput = GetThroughput(n * sizeof(uint64_t), time);
+    std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "DONE: " << time << '\n';
+}
+
+void InMemoryMapTest(int argc, char **argv) {
+    CHECK(argc > 2) << "Expected number of elements to map";
+    const size_t n = 1UL << strtol(argv[2], nullptr, 10);
+    double time = InMemoryMapTime(n);
+    double throughput = GetThroughput(n * sizeof(uint64_t), time);
     std::cout << "Throughput: " << throughput << "GB\n";
     std::cout << "DONE: " << time << '\n';
 }
@@ -5,6 +5,8 @@
 #ifndef SORTING_IN_MEMORY_BENCHMARKS_H
 #define SORTING_IN_MEMORY_BENCHMARKS_H
 
+#include <cstddef>
+
 void InMemorySortingTest(int argc, char **argv);
 
 void InMemoryPermutationTest(int argc, char **argv);
@@ -13,4 +15,14 @@ void InMemoryReduceTest(int argc, char **argv);
 
 void InMemoryMapTest(int argc, char **argv);
 
+/**
+ * Time to reduce n random 64-bit integers (xor) in memory, which bounds the throughput of an external reduce.
+ */
+double InMemoryReduceTime(size_t n);
+
+/**
+ * Time to map n random 64-bit integers (divide by 2) in memory, which bounds the throughput of an external map.
+ */
+double InMemoryMapTime(size_t n);
+
 #endif //SORTING_IN_MEMORY_BENCHMARKS_H
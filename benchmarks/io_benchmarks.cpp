@@ -5,6 +5,13 @@
 #include "benchmarks/io_benchmarks.h"
 
 #include <map>
+#include <queue>
+#include <tuple>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <system_error>
 #include "utils/unordered_file_writer.h"
 #include "utils/unordered_file_reader.h"
 #include "utils/ordered_file_writer.h"
@@ -13,6 +20,9 @@
 #include "parlay/primitives.h"
 #include "absl/log/log.h"
 #include "utils/random_read.h"
+#include "utils/lookup_service.h"
+#include "utils/block_cache.h"
+#include "utils/random_number_generator.h"
 
 const size_t SINGLE_IO_SIZE = 4 * (1UL << 20);
 
@@ -62,6 +72,7 @@ void UnorderedReadTest(int argc, char **argv) {
     using Type = long long;
     parlay::internal::timer timer("Unordered read");
     auto files = FindFiles(std::string(argv[2]));
+    GetFileInfo(files);
     size_t expected_size = 0;
     for (auto &file: files) {
         expected_size += file.file_size;
@@ -144,11 +155,12 @@ void UnorderedWriteTest(int argc, char **argv) {
 void RandomReadTest(int argc, char **argv) {
     using Type = uint64_t;
     if (argc < 4) {
-        std::cout << argv[0] << " " << argv[1] << " <file prefix> <num reads>";
+        std::cout << argv[0] << " " << argv[1] << " <file prefix> <num reads> [coalesced read size]";
         return;
     }
     std::string prefix(argv[2]);
     size_t n = ParseLong(argv[3]);
+    size_t max_read_size = argc > 4 ? ParseLong(argv[4]) : 0;
     parlay::internal::timer timer("random read");
 
     std::random_device rd;
@@ -176,6 +188,194 @@ void RandomReadTest(int argc, char **argv) {
     double iops = (double) n / time;
     std::cout.precision(10);
     std::cout << "Throughput (inc. wasted bandwidth): " << throughput << " GB/s. IOPS: " << iops;
+    if (max_read_size > 0) {
+        timer.next("Begin coalesced random read");
+        auto coalesced = RandomBatchReadCoalesced<Type>(files, queries, max_read_size);
+        double coalesced_time = timer.next_time();
+        CHECK(coalesced == result) << "Coalesced reads returned different elements";
+        std::cout << "\nCoalesced: " << (double) n / coalesced_time << " elements per second ("
+                  << time / coalesced_time << "x)";
+    }
+}
+
+/**
+ * Read random byte ranges, many of which span blocks and files, with RandomBatchReadRanges and check each of them
+ * against ReadFileRange. With "aligned", ranges start and end on block boundaries, so most of them are read straight
+ * into the output.
+ */
+void RangeReadTest(int argc, char **argv) {
+    if (argc < 5) {
+        std::cout << argv[0] << " " << argv[1] << " <file prefix> <num ranges> <max range size> [aligned]";
+        return;
+    }
+    std::string prefix(argv[2]);
+    size_t n = ParseLong(argv[3]);
+    size_t max_size = ParseLong(argv[4]);
+    bool aligned = argc > 5 && std::string(argv[5]) == "aligned";
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    CHECK(!files.empty()) << "No file with prefix " << prefix << " found";
+    ComputeBeforeSize(files);
+    size_t total_size = files.back().before_size + files.back().true_size;
+
+    parlay::random_generator gen;
+    std::uniform_int_distribution<size_t> dis_offset(0, total_size - 1), dis_size(0, max_size);
+    auto ranges = parlay::tabulate(n, [&](size_t i) {
+        auto g = gen[i];
+        size_t offset = dis_offset(g), size = dis_size(g);
+        if (aligned) {
+            offset = AlignDown(offset);
+            size = AlignDown(size);
+        }
+        return std::make_pair(offset, std::min(size, total_size - offset));
+    });
+    auto output_offsets = parlay::scan(parlay::map(ranges, [](const auto &range) { return range.second; }));
+    auto output = std::unique_ptr<unsigned char, decltype(&free)>(
+            (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, AlignUp(output_offsets.second + 1)),
+            free);
+    parlay::internal::timer timer("range read");
+    RandomBatchReadRanges(files, ranges, output.get());
+    double time = timer.next_time();
+    std::cout.precision(10);
+    std::cout << "Read " << n << " ranges (" << output_offsets.second << " bytes) in " << time << " seconds: "
+              << (double) output_offsets.second / 1e9 / time << " GB/s" << std::endl;
+
+    parlay::parallel_for(0, n, [&](size_t i) {
+        if (ranges[i].second == 0) {
+            return;
+        }
+        auto expected = parlay::sequence<unsigned char>::uninitialized(ranges[i].second);
+        ReadFileRange(files, ranges[i].first, ranges[i].second, expected.data());
+        CHECK(memcmp(expected.data(), output.get() + output_offsets.first[i], ranges[i].second) == 0)
+            << "Range " << i << " [" << ranges[i].first << ", " << ranges[i].first + ranges[i].second
+            << ") does not match";
+    });
+    LOG(INFO) << "Tests passed. All ranges match the files.";
+}
+
+/**
+ * Batches of Zipfian point lookups through a BlockCache; checks every batch against uncached reads and reports the hit
+ * rate and the speedup over RandomBatchRead
+ */
+void BlockCacheTest(int argc, char **argv) {
+    using Type = uint64_t;
+    if (argc < 6) {
+        std::cout << argv[0] << " " << argv[1] << " <file prefix> <lookups per batch> <batches> <cache size in MiB>"
+                  << " [zipf parameter]";
+        return;
+    }
+    std::string prefix(argv[2]);
+    size_t batch_size = ParseLong(argv[3]);
+    size_t num_batches = ParseLong(argv[4]);
+    size_t cache_size = ParseLong(argv[5]) << 20;
+    double s = argc > 6 ? ParseDouble(argv[6]) : 0.99;
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    CHECK(!files.empty()) << "No file with prefix " << prefix << " found";
+    size_t n = 0;
+    for (auto &file: files) {
+        n += file.true_size / sizeof(Type);
+    }
+    // scatter the popular ranks over the dataset, so that hot elements do not share blocks
+    auto ranks = GenerateZipfianDistribution<Type>(batch_size * num_batches, s, n);
+    auto positions = parlay::map(ranks, [&](Type rank) { return (size_t) ((rank - 1) * 0x9E3779B1UL % n); });
+
+    BlockCache cache(cache_size);
+    double cached_time = 0, direct_time = 0;
+    parlay::internal::timer timer("block cache");
+    for (size_t b = 0; b < num_batches; b++) {
+        auto batch = parlay::tabulate(batch_size, [&](size_t i) { return positions[b * batch_size + i]; });
+        timer.next_time();
+        auto result = cache.Read<Type>(files, batch);
+        cached_time += timer.next_time();
+        auto expected = RandomBatchRead<Type>(files, batch);
+        direct_time += timer.next_time();
+        CHECK(result == expected) << "Batch " << b << " does not match the files";
+    }
+    auto stats = cache.GetStats();
+    std::cout.precision(4);
+    std::cout << "Hit rate: " << stats.HitRate() * 100 << "% (" << stats.hits << " of " << stats.lookups
+              << " lookups); " << stats.block_reads << " block reads; " << stats.evictions << " evictions" << std::endl;
+    std::cout << "Cached: " << (double) positions.size() / cached_time << " lookups per second; uncached: "
+              << (double) positions.size() / direct_time << " lookups per second" << std::endl;
+    LOG(INFO) << "Tests passed. All lookups match the files.";
+}
+
+/**
+ * Client threads keep a window of lookups outstanding in a LookupService and record the latency of each one
+ */
+void LookupServiceTest(int argc, char **argv) {
+    using Type = uint64_t;
+    if (argc < 4) {
+        std::cout << argv[0] << " " << argv[1] << " <file prefix> <num lookups> [client threads] [I/O threads]";
+        return;
+    }
+    std::string prefix(argv[2]);
+    size_t n = ParseLong(argv[3]);
+    size_t num_clients = argc > 4 ? ParseLong(argv[4]) : 16;
+    size_t num_io_threads = argc > 5 ? ParseLong(argv[5]) : 4;
+    const size_t WINDOW = 16;
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    CHECK(!files.empty()) << "No file with prefix " << prefix << " found";
+    size_t total_size = 0;
+    for (auto &file: files) {
+        total_size += file.true_size;
+    }
+    parlay::random_generator gen;
+    std::uniform_int_distribution<size_t> dis(0, total_size / sizeof(Type) - 1);
+    auto queries = parlay::tabulate(n, [&](size_t i) {
+        auto g = gen[i];
+        return dis(g);
+    });
+
+    LookupService<Type> service(files, num_io_threads);
+    // a position past the end is reported to the client instead of reaching the I/O threads
+    bool rejected = false;
+    try {
+        service.Lookup(total_size / sizeof(Type)).get();
+    } catch (const std::system_error &e) {
+        rejected = e.code().value() == EINVAL;
+    }
+    CHECK(rejected) << "Lookup past the end of the dataset was not rejected";
+    auto results = parlay::sequence<Type>::uninitialized(n);
+    auto latencies = parlay::sequence<double>::uninitialized(n);
+    parlay::internal::timer timer("lookup service");
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < num_clients; c++) {
+        clients.emplace_back([&, c]() {
+            using Clock = std::chrono::steady_clock;
+            std::queue<std::tuple<size_t, Clock::time_point, std::future<Type>>> window;
+            const auto finish_one = [&]() {
+                auto &[i, start, future] = window.front();
+                results[i] = future.get();
+                latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                window.pop();
+            };
+            for (size_t i = c; i < n; i += num_clients) {
+                if (window.size() == WINDOW) {
+                    finish_one();
+                }
+                window.emplace(i, Clock::now(), service.Lookup(queries[i]));
+            }
+            while (!window.empty()) {
+                finish_one();
+            }
+        });
+    }
+    for (auto &client: clients) {
+        client.join();
+    }
+    double time = timer.next_time();
+    auto expected = RandomBatchRead<Type>(files, queries);
+    for (size_t i = 0; i < n; i++) {
+        CHECK(results[i] == expected[i]) << "Lookup " << i << " of position " << queries[i] << " returned "
+                                         << results[i] << " instead of " << expected[i];
+    }
+    parlay::sort_inplace(latencies);
+    std::cout.precision(10);
+    std::cout << "IOPS: " << (double) n / time << ". Latency (us) p50: " << latencies[n / 2]
+              << " p99: " << latencies[n * 99 / 100] << " p99.9: " << latencies[n * 999 / 1000] << '\n';
 }
 
 void LargeReadTest(int argc, char **argv) {
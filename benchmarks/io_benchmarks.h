@@ -13,6 +13,12 @@ void OrderedFileWriterTest(int argc, char **argv);
 
 void RandomReadTest(int argc, char **argv);
 
+void RangeReadTest(int argc, char **argv);
+
+void LookupServiceTest(int argc, char **argv);
+
+void BlockCacheTest(int argc, char **argv);
+
 void LargeReadTest(int argc, char **argv);
 
 #endif //SORTING_IO_BENCHMARKS_H
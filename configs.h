@@ -32,4 +32,9 @@ constexpr size_t O_DIRECT_MEMORY_ALIGNMENT = O_DIRECT_MULTIPLE;
 constexpr size_t METADATA_SIZE = 2;
 constexpr size_t IO_URING_BUFFER_SIZE = 64;
 
+// RandomBatchReadCoalesced merges the blocks of nearby requests into reads of up to this many bytes...
+constexpr size_t RANDOM_READ_COALESCE_SIZE = 128 << 10;
+// ... as long as the blocks are at most this many bytes apart
+constexpr size_t RANDOM_READ_MAX_GAP = O_DIRECT_MULTIPLE;
+
 #endif //SORTING_CONFIGS_H
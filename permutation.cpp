@@ -10,14 +10,16 @@
 
 void RunTest(int argc, char **argv) {
     if (argc < 4) {
-        LOG(ERROR) << "Usage: " << argv[0] << " run <input prefix> <output prefix>";
+        LOG(ERROR) << "Usage: " << argv[0] << " run <input prefix> <output prefix> [seed]";
         return;
     }
     std::string input_prefix(argv[2]), output_prefix(argv[3]);
     auto input_files = FindFiles(input_prefix);
     Permutation<size_t> permutation;
     parlay::internal::timer timer("Permutation");
-    auto result_files = permutation.Permute(input_files, output_prefix);
+    // a seed makes the permutation reproducible
+    auto result_files = argc >= 5 ? permutation.Permute(input_files, output_prefix, ParseLong(argv[4]))
+                                  : permutation.Permute(input_files, output_prefix);
     timer.next("DONE");
 }
 
@@ -39,6 +41,67 @@ void Verify(int argc, char **argv) {
     }
 }
 
+void RunApply(int argc, char **argv) {
+    if (argc < 6) {
+        LOG(ERROR) << "Usage: " << argv[0]
+                   << " apply <input prefix> <index prefix> <index files have end markers: 1|0> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), index_prefix(argv[3]), output_prefix(argv[5]);
+    bool index_markers = (bool) ParseLong(argv[4]);
+    auto input_files = FindFiles(input_prefix);
+    auto index_files = FindFiles(index_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(index_files, index_markers);
+    Permutation<size_t> permutation;
+    parlay::internal::timer timer("Apply permutation");
+    auto result_files = permutation.ApplyPermutation(input_files, index_files, output_prefix);
+    timer.next("DONE");
+}
+
+template<typename T>
+parlay::sequence<T> ReadSequence(const std::vector<FileInfo> &files) {
+    return parlay::flatten(parlay::map(files, [](const FileInfo &f) {
+        auto ptr = (T *) ReadEntireFile(f.file_name, f.file_size);
+        parlay::sequence<T> result(ptr, ptr + f.true_size / sizeof(T));
+        free(ptr);
+        return result;
+    }, 1));
+}
+
+void VerifyApply(int argc, char **argv) {
+    if (argc < 6) {
+        LOG(ERROR) << "Usage: " << argv[0]
+                   << " verify_apply <input prefix> <index prefix> <index files have end markers: 1|0> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), index_prefix(argv[3]), output_prefix(argv[5]);
+    bool index_markers = (bool) ParseLong(argv[4]);
+    auto input_files = FindFiles(input_prefix);
+    auto index_files = FindFiles(index_prefix);
+    auto output_files = FindFiles(output_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(index_files, index_markers);
+    GetFileInfo(output_files);
+    auto input = ReadSequence<size_t>(input_files);
+    auto indices = ReadSequence<size_t>(index_files);
+    auto output = ReadSequence<size_t>(output_files);
+    // the last output file may be padded to a multiple of O_DIRECT_MULTIPLE
+    if (input.size() != indices.size() || output.size() < input.size()) {
+        LOG(ERROR) << "Size mismatch: " << input.size() << " values, " << indices.size() << " indices and "
+                   << output.size() << " results";
+        return;
+    }
+    for (size_t i = 0; i < input.size(); i++) {
+        if (output[indices[i]] != input[i]) {
+            LOG(ERROR) << "Mismatch at index " << i << ": expected " << input[i] << " at position " << indices[i]
+                       << ", got " << output[indices[i]];
+            return;
+        }
+    }
+    LOG(INFO) << "Tests passed. All " << input.size() << " elements are in place.";
+}
+
 int main(int argc, char **argv) {
     ParseGlobalArguments(argc, argv);
     if (argc < 2) {
@@ -48,8 +111,10 @@ int main(int argc, char **argv) {
     }
     std::map<std::string, std::function<void(int, char **)>> commands(
         {
-            {"run",    RunTest},
-            {"Verify", Verify}
+            {"run",          RunTest},
+            {"Verify",       Verify},
+            {"apply",        RunApply},
+            {"verify_apply", VerifyApply}
         }
     );
     if (commands.count(argv[1])) {
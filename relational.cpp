@@ -0,0 +1,462 @@
+#include <map>
+#include <random>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "scatter_gather_algorithms/distinct.h"
+#include "scatter_gather_algorithms/hash_index.h"
+#include "scatter_gather_algorithms/hash_join.h"
+#include "scatter_gather_algorithms/reduce_by_key.h"
+#include "scatter_gather_algorithms/semisort.h"
+#include "sequence_algorithms/semi_join.h"
+#include "sequence_algorithms/set_operations.h"
+#include "sequence_algorithms/zip_with.h"
+#include "utils/command_line.h"
+
+using Key = size_t;
+using Value = size_t;
+using Pair = std::pair<Key, Value>;
+
+/**
+ * Read a whole dataset into memory for verification
+ */
+template<typename T>
+parlay::sequence<T> ReadAll(const std::vector<FileInfo> &files) {
+    return parlay::flatten(parlay::map(files, [](const FileInfo &file) {
+        auto ptr = (T *) ReadEntireFile(file.file_name, file.file_size);
+        parlay::sequence<T> data(ptr, ptr + file.true_size / sizeof(T));
+        free(ptr);
+        return data;
+    }));
+}
+
+void MakePairs(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0] << " pairs <key prefix> <value prefix> <output prefix>";
+        return;
+    }
+    std::string key_prefix(argv[2]), value_prefix(argv[3]), output_prefix(argv[4]);
+    auto key_files = FindFiles(key_prefix), value_files = FindFiles(value_prefix);
+    GetFileInfo(key_files);
+    GetFileInfo(value_files);
+    ZipWith<Key, Value, Pair>(key_files, value_files, output_prefix, [](Key k, Value v) {
+        return Pair(k, v);
+    });
+}
+
+void RunReduceByKey(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " reduce_by_key <pair prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto files = FindFiles(input_prefix);
+    GetFileInfo(files);
+    parlay::internal::timer timer("Reduce by key");
+    auto results = ReduceByKey<Key, Value>().Run(files, output_prefix, parlay::plus<Value>());
+    double time = timer.next_time();
+    size_t num_keys = 0;
+    for (const auto &f: results) {
+        num_keys += f.true_size / sizeof(Pair);
+    }
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+    std::cout << "Distinct keys: " << num_keys << "\n";
+}
+
+void VerifyReduceByKey(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_reduce_by_key <pair prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix), output_files = FindFiles(output_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(output_files, true);
+    absl::flat_hash_map<Key, Value> expected;
+    for (const auto &[k, v]: ReadAll<Pair>(input_files)) {
+        expected[k] += v;
+    }
+    auto actual = ReadAll<Pair>(output_files);
+    CHECK(actual.size() == expected.size()) << "Expected " << expected.size() << " keys, got " << actual.size();
+    for (const auto &[k, v]: actual) {
+        auto it = expected.find(k);
+        CHECK(it != expected.end()) << "Key " << k << " is not in the input or appears twice";
+        CHECK(it->second == v) << "Key " << k << ": expected " << it->second << " actual " << v;
+        expected.erase(it);
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunSemisort(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " semisort <input prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto files = FindFiles(input_prefix);
+    parlay::internal::timer timer("Semisort");
+    Semisort<size_t, size_t>().Run(files, output_prefix, [](size_t x) { return x; });
+    double time = timer.next_time();
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+}
+
+void VerifySemisort(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_semisort <input prefix> <output prefix>";
+        return;
+    }
+    using T = size_t;
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix), output_files = FindFiles(output_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(output_files, true);
+    auto input = ReadAll<T>(input_files), output = ReadAll<T>(output_files);
+    CHECK(input.size() == output.size()) << "Expected " << input.size() << " elements, got " << output.size();
+    CHECK(parlay::sort(input) == parlay::sort(output)) << "The output is not a permutation of the input";
+    // every key must form a single run
+    absl::flat_hash_map<T, size_t> runs;
+    for (size_t i = 0; i < output.size(); i++) {
+        if (i == 0 || output[i] != output[i - 1]) {
+            CHECK(++runs[output[i]] == 1) << "Key " << output[i] << " is split at position " << i;
+        }
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunHashJoin(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0] << " hash_join <left pair prefix> <right pair prefix> <output prefix>";
+        return;
+    }
+    std::string left_prefix(argv[2]), right_prefix(argv[3]), output_prefix(argv[4]);
+    auto left_files = FindFiles(left_prefix), right_files = FindFiles(right_prefix);
+    const auto key = [](const Pair &p) { return p.first; };
+    parlay::internal::timer timer("Hash join");
+    auto results = HashJoin<Pair, Pair, Key>().Run(left_files, right_files, output_prefix, key, key);
+    double time = timer.next_time();
+    size_t matches = 0;
+    for (const auto &f: results) {
+        matches += f.true_size / sizeof(std::pair<Pair, Pair>);
+    }
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << (GetThroughput(left_files, time) + GetThroughput(right_files, time)) << "GB\n";
+    std::cout << "Matches: " << matches << "\n";
+}
+
+void VerifyHashJoin(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0]
+                   << " verify_hash_join <left pair prefix> <right pair prefix> <output prefix>";
+        return;
+    }
+    std::string left_prefix(argv[2]), right_prefix(argv[3]), output_prefix(argv[4]);
+    auto left_files = FindFiles(left_prefix), right_files = FindFiles(right_prefix);
+    auto output_files = FindFiles(output_prefix);
+    GetFileInfo(left_files);
+    GetFileInfo(right_files);
+    GetFileInfo(output_files, true);
+    // every key matches (left count) * (right count) times
+    absl::flat_hash_map<Key, std::pair<size_t, size_t>> counts;
+    for (const auto &p: ReadAll<Pair>(left_files)) {
+        counts[p.first].first++;
+    }
+    for (const auto &p: ReadAll<Pair>(right_files)) {
+        counts[p.first].second++;
+    }
+    absl::flat_hash_map<Key, size_t> expected;
+    size_t total = 0;
+    for (const auto &[k, c]: counts) {
+        if (c.first * c.second > 0) {
+            expected[k] = c.first * c.second;
+            total += c.first * c.second;
+        }
+    }
+    auto actual = ReadAll<std::pair<Pair, Pair>>(output_files);
+    CHECK(actual.size() == total) << "Expected " << total << " matches, got " << actual.size();
+    for (const auto &[l, r]: actual) {
+        CHECK(l.first == r.first) << "Keys " << l.first << " and " << r.first << " do not match";
+        auto it = expected.find(l.first);
+        CHECK(it != expected.end() && it->second > 0) << "Key " << l.first << " has too many matches";
+        it->second--;
+    }
+    LOG(INFO) << "Test passed";
+}
+
+/**
+ * The metadata file must not start with the prefix, or FindFiles would take it for a page file
+ */
+std::string GetHashIndexName(const std::string &prefix) {
+    return GetSSDList()[0] + "/hash_index." + prefix;
+}
+
+void BuildHashIndex(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " hash_index <pair prefix> <index prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), index_prefix(argv[3]);
+    auto files = FindFiles(input_prefix);
+    HashIndex<Pair, Key> index;
+    parlay::internal::timer timer("Hash index");
+    index.Build(files, index_prefix, [](const Pair &p) { return p.first; });
+    index.Save(GetHashIndexName(index_prefix));
+    double time = timer.next_time();
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+}
+
+void HashLookup(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " hash_lookup <index prefix> <key> [key ...]";
+        return;
+    }
+    HashIndex<Pair, Key> index;
+    index.Load(GetHashIndexName(argv[2]));
+    parlay::sequence<Key> keys;
+    for (int i = 3; i < argc; i++) {
+        keys.push_back(ParseLong(argv[i]));
+    }
+    auto results = index.Lookup(keys, [](const Pair &p) { return p.first; });
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (results[i]) {
+            std::cout << keys[i] << ": " << results[i]->second << "\n";
+        } else {
+            std::cout << keys[i] << ": not found\n";
+        }
+    }
+}
+
+/**
+ * Look up random keys (half of them present) and check the results against the pairs in memory
+ */
+void VerifyHashIndex(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_hash_index <pair prefix> <index prefix> [number of lookups]";
+        return;
+    }
+    std::string input_prefix(argv[2]), index_prefix(argv[3]);
+    size_t num_lookups = argc > 4 ? ParseLong(argv[4]) : 1000000;
+    auto files = FindFiles(input_prefix);
+    GetFileInfo(files);
+    auto pairs = ReadAll<Pair>(files);
+    CHECK(!pairs.empty()) << "No pairs in " << input_prefix;
+    absl::flat_hash_set<Pair> pair_set(pairs.begin(), pairs.end());
+    absl::flat_hash_set<Key> key_set;
+    for (const auto &p: pairs) {
+        key_set.insert(p.first);
+    }
+    std::mt19937_64 rng(42);
+    parlay::sequence<Key> keys(num_lookups);
+    for (size_t i = 0; i < num_lookups; i++) {
+        keys[i] = i % 2 == 0 ? pairs[rng() % pairs.size()].first : (Key) rng();
+    }
+    HashIndex<Pair, Key> index;
+    index.Load(GetHashIndexName(index_prefix));
+    parlay::internal::timer timer("Hash lookups");
+    auto results = index.Lookup(keys, [](const Pair &p) { return p.first; });
+    double time = timer.next_time();
+    for (size_t i = 0; i < num_lookups; i++) {
+        if (key_set.contains(keys[i])) {
+            CHECK(results[i] && results[i]->first == keys[i] && pair_set.contains(*results[i]))
+                << "Wrong result for key " << keys[i];
+        } else {
+            CHECK(!results[i]) << "Key " << keys[i] << " is not in the dataset but was found";
+        }
+    }
+    std::cout << "Lookups per second: " << (double) num_lookups / time << "\n";
+    LOG(INFO) << "Test passed";
+}
+
+void RunSemiJoin(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0] << " semi_join <pair prefix> <key prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), key_prefix(argv[3]), output_prefix(argv[4]);
+    auto files = FindFiles(input_prefix), key_files = FindFiles(key_prefix);
+    GetFileInfo(files);
+    GetFileInfo(key_files);
+    parlay::internal::timer timer("Semi-join");
+    auto results = SemiJoin<Pair, Key>(files, key_files, output_prefix, [](const Pair &p) { return p.first; });
+    double time = timer.next_time();
+    size_t survivors = 0;
+    for (const auto &f: results) {
+        survivors += f.true_size / sizeof(Pair);
+    }
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+    std::cout << "Survivors: " << survivors << "\n";
+}
+
+void VerifySemiJoin(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_semi_join <pair prefix> <key prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), key_prefix(argv[3]), output_prefix(argv[4]);
+    auto files = FindFiles(input_prefix), key_files = FindFiles(key_prefix), output_files = FindFiles(output_prefix);
+    GetFileInfo(files);
+    GetFileInfo(key_files);
+    GetFileInfo(output_files, true);
+    auto keys = ReadAll<Key>(key_files);
+    absl::flat_hash_set<Key> key_set(keys.begin(), keys.end());
+    auto expected = parlay::filter(ReadAll<Pair>(files), [&](const Pair &p) { return key_set.contains(p.first); });
+    auto actual = ReadAll<Pair>(output_files);
+    CHECK(actual.size() == expected.size()) << "Expected " << expected.size() << " survivors, got " << actual.size();
+    for (size_t i = 0; i < actual.size(); i++) {
+        CHECK(actual[i] == expected[i]) << "Mismatch at position " << i;
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunDistinct(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " distinct <input prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto files = FindFiles(input_prefix);
+    parlay::internal::timer timer("Distinct");
+    auto results = Distinct<size_t>().Run(files, output_prefix);
+    double time = timer.next_time();
+    size_t count = 0;
+    for (const auto &f: results) {
+        count += f.true_size / sizeof(size_t);
+    }
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+    std::cout << "Distinct values: " << count << "\n";
+}
+
+void CountDistinct(int argc, char **argv) {
+    if (argc < 3) {
+        LOG(ERROR) << "Usage: " << argv[0] << " count_distinct <input prefix>";
+        return;
+    }
+    auto files = FindFiles(argv[2]);
+    parlay::internal::timer timer("Count distinct");
+    size_t count = Distinct<size_t>().Count(files);
+    double time = timer.next_time();
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << GetThroughput(files, time) << "GB\n";
+    std::cout << "Distinct values: " << count << "\n";
+}
+
+void VerifyDistinct(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_distinct <input prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix), output_files = FindFiles(output_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(output_files, true);
+    auto input = ReadAll<size_t>(input_files);
+    absl::flat_hash_set<size_t> expected(input.begin(), input.end());
+    auto actual = ReadAll<size_t>(output_files);
+    CHECK(actual.size() == expected.size()) << "Expected " << expected.size() << " values, got " << actual.size();
+    for (size_t x: actual) {
+        CHECK(expected.erase(x) == 1) << "Value " << x << " is not in the input or appears twice";
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunSortedSetOperation(int argc, char **argv) {
+    if (argc < 6) {
+        LOG(ERROR) << "Usage: " << argv[0]
+                   << " sorted_set <intersect|union|difference> <sorted prefix a> <sorted prefix b> <output prefix>";
+        return;
+    }
+    std::string operation(argv[2]), a_prefix(argv[3]), b_prefix(argv[4]), output_prefix(argv[5]);
+    auto a_files = FindFiles(a_prefix), b_files = FindFiles(b_prefix);
+    GetFileInfo(a_files, true);
+    GetFileInfo(b_files, true);
+    parlay::internal::timer timer("Sorted set operation");
+    std::vector<FileInfo> results;
+    if (operation == "intersect") {
+        results = SortedIntersect<size_t>(a_files, b_files, output_prefix);
+    } else if (operation == "union") {
+        results = SortedUnion<size_t>(a_files, b_files, output_prefix);
+    } else if (operation == "difference") {
+        results = SortedDifference<size_t>(a_files, b_files, output_prefix);
+    } else {
+        LOG(ERROR) << "Unknown operation " << operation;
+        return;
+    }
+    double time = timer.next_time();
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << (GetThroughput(a_files, time) + GetThroughput(b_files, time)) << "GB\n";
+    std::cout << "Output elements: " << (results.back().before_size + results.back().true_size) / sizeof(size_t)
+              << "\n";
+}
+
+void VerifySortedSetOperation(int argc, char **argv) {
+    if (argc < 6) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_sorted_set <intersect|union|difference> <sorted prefix a> "
+                   << "<sorted prefix b> <output prefix>";
+        return;
+    }
+    std::string operation(argv[2]), a_prefix(argv[3]), b_prefix(argv[4]), output_prefix(argv[5]);
+    auto a_files = FindFiles(a_prefix), b_files = FindFiles(b_prefix), output_files = FindFiles(output_prefix);
+    GetFileInfo(a_files, true);
+    GetFileInfo(b_files, true);
+    GetFileInfo(output_files, true);
+    auto a = ReadAll<size_t>(a_files), b = ReadAll<size_t>(b_files);
+    std::vector<size_t> expected;
+    if (operation == "intersect") {
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    } else if (operation == "union") {
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    } else {
+        std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    }
+    auto actual = ReadAll<size_t>(output_files);
+    CHECK(actual.size() == expected.size()) << "Expected " << expected.size() << " elements, got " << actual.size();
+    for (size_t i = 0; i < actual.size(); i++) {
+        CHECK(actual[i] == expected[i]) << "Mismatch at position " << i;
+    }
+    LOG(INFO) << "Test passed";
+}
+
+int main(int argc, char **argv) {
+    ParseGlobalArguments(argc, argv);
+    if (argc < 2) {
+        show_usage:
+        LOG(ERROR) << "Usage: " << argv[0] << " <pairs|reduce_by_key|...> <command-specific options>";
+        return 0;
+    }
+    std::map<std::string, std::function<void(int, char **)>> commands(
+            {
+                    {"pairs",                MakePairs},
+                    {"reduce_by_key",        RunReduceByKey},
+                    {"verify_reduce_by_key", VerifyReduceByKey},
+                    {"semisort",             RunSemisort},
+                    {"verify_semisort",      VerifySemisort},
+                    {"hash_join",            RunHashJoin},
+                    {"verify_hash_join",     VerifyHashJoin},
+                    {"hash_index",           BuildHashIndex},
+                    {"hash_lookup",          HashLookup},
+                    {"verify_hash_index",    VerifyHashIndex},
+                    {"semi_join",            RunSemiJoin},
+                    {"verify_semi_join",     VerifySemiJoin},
+                    {"distinct",             RunDistinct},
+                    {"count_distinct",       CountDistinct},
+                    {"verify_distinct",      VerifyDistinct},
+                    {"sorted_set",           RunSortedSetOperation},
+                    {"verify_sorted_set",    VerifySortedSetOperation}
+            }
+    );
+    if (commands.count(argv[1])) {
+        commands[argv[1]](argc, argv);
+    } else {
+        goto show_usage;
+    }
+}
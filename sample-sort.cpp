@@ -5,6 +5,7 @@
 #include <random>
 
 #include "scatter_gather_algorithms/sample_sort.h"
+#include "scatter_gather_algorithms/sorted_dataset.h"
 #include "utils/random_number_generator.h"
 #include "utils/command_line.h"
 #include "utils/unordered_file_writer.h"
@@ -260,6 +261,299 @@ void RunTest(int argc, char **argv) {
     timer.next("DONE");
 }
 
+void RunRank(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " rank <input prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix);
+    SampleSort<size_t> sorter;
+    parlay::internal::timer timer("Rank");
+    auto result_files = sorter.Rank(input_files, output_prefix, std::less<>());
+    timer.next("DONE");
+}
+
+template<typename T>
+parlay::sequence<T> ReadSequence(const std::vector<FileInfo> &files) {
+    return parlay::flatten(parlay::map(files, [](const FileInfo &f) {
+        auto ptr = (T *) ReadEntireFile(f.file_name, f.file_size);
+        parlay::sequence<T> result(ptr, ptr + f.true_size / sizeof(T));
+        free(ptr);
+        return result;
+    }, 1));
+}
+
+void RunSelect(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " select <input prefix> <rank> [rank ...]";
+        return;
+    }
+    std::string input_prefix(argv[2]);
+    std::vector<size_t> ranks;
+    for (int i = 3; i < argc; i++) {
+        ranks.push_back(ParseLong(argv[i]));
+    }
+    auto input_files = FindFiles(input_prefix);
+    SampleSort<size_t> sorter;
+    parlay::internal::timer timer("Select");
+    auto result = sorter.Select(input_files, ranks, std::less<>());
+    timer.next("DONE");
+    for (size_t i = 0; i < ranks.size(); i++) {
+        std::cout << "Rank " << ranks[i] << ": " << result[i] << '\n';
+    }
+}
+
+/**
+ * Check the result of select against a full in-memory sort
+ */
+void VerifySelect(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_select <input prefix> <rank> [rank ...]";
+        return;
+    }
+    std::string input_prefix(argv[2]);
+    std::vector<size_t> ranks;
+    for (int i = 3; i < argc; i++) {
+        ranks.push_back(ParseLong(argv[i]));
+    }
+    auto input_files = FindFiles(input_prefix);
+    SampleSort<size_t> sorter;
+    auto result = sorter.Select(input_files, ranks, std::less<>());
+    auto sorted = parlay::sort(ReadSequence<size_t>(input_files));
+    for (size_t i = 0; i < ranks.size(); i++) {
+        if (result[i] != sorted[ranks[i]]) {
+            LOG(ERROR) << "Mismatch at rank " << ranks[i] << ": expected " << sorted[ranks[i]] << ", got " << result[i];
+            return;
+        }
+    }
+    LOG(INFO) << "Tests passed. All " << ranks.size() << " ranks are correct.";
+}
+
+/**
+ * Check the result of rank on a permutation of 0 to n - 1 (i.e. data generated by gen with type 1).
+ * The rank of every element in such a permutation is the element itself.
+ */
+void VerifyRank(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_rank <input prefix> <rank prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), rank_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix);
+    auto rank_files = FindFiles(rank_prefix);
+    GetFileInfo(input_files);
+    GetFileInfo(rank_files, true);
+    auto input = ReadSequence<size_t>(input_files);
+    auto ranks = ReadSequence<size_t>(rank_files);
+    if (input.size() != ranks.size()) {
+        LOG(ERROR) << "Expected " << input.size() << " ranks, got " << ranks.size();
+        return;
+    }
+    for (size_t i = 0; i < input.size(); i++) {
+        if (input[i] != ranks[i]) {
+            LOG(ERROR) << "Mismatch at index " << i << ": expected " << input[i] << ", got " << ranks[i];
+            return;
+        }
+    }
+    LOG(INFO) << "Tests passed. All " << input.size() << " ranks are correct.";
+}
+
+void CreateDataset(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " create <input prefix> <dataset prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), dataset_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix);
+    SortedDataset<size_t> dataset(dataset_prefix);
+    parlay::internal::timer timer("Create");
+    dataset.Create(input_files);
+    timer.next("DONE");
+}
+
+void AppendToDataset(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " append <dataset prefix> <delta prefix> [max pending runs]";
+        return;
+    }
+    std::string dataset_prefix(argv[2]), delta_prefix(argv[3]);
+    CompactionPolicy policy;
+    if (argc > 4) {
+        policy.max_runs = ParseLong(argv[4]);
+    }
+    auto delta_files = FindFiles(delta_prefix);
+    SortedDataset<size_t> dataset(dataset_prefix, {}, policy);
+    dataset.Load();
+    parlay::internal::timer timer("Append");
+    dataset.Append(delta_files);
+    timer.next("DONE");
+    std::cout << "Pending runs: " << dataset.PendingRuns() << '\n';
+}
+
+void CompactDataset(int argc, char **argv) {
+    if (argc < 3) {
+        LOG(ERROR) << "Usage: " << argv[0] << " compact <dataset prefix>";
+        return;
+    }
+    SortedDataset<size_t> dataset(argv[2]);
+    dataset.Load();
+    parlay::internal::timer timer("Compact");
+    dataset.Compact();
+    timer.next("DONE");
+}
+
+/**
+ * Check that a fully compacted dataset holds exactly the elements of its inputs in sorted order
+ */
+void VerifyDataset(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_dataset <dataset prefix> <input prefix> [input prefix ...]";
+        return;
+    }
+    SortedDataset<size_t> dataset(argv[2]);
+    dataset.Load();
+    if (dataset.PendingRuns() > 0) {
+        LOG(ERROR) << dataset.PendingRuns() << " runs are pending; compact the dataset first";
+        return;
+    }
+    parlay::sequence<size_t> expected;
+    for (int i = 3; i < argc; i++) {
+        auto input_files = FindFiles(argv[i]);
+        GetFileInfo(input_files);
+        expected = parlay::append(expected, ReadSequence<size_t>(input_files));
+    }
+    expected = parlay::sort(expected);
+    auto actual = ReadSequence<size_t>(dataset.Files());
+    if (actual.size() != expected.size()) {
+        LOG(ERROR) << "Expected " << expected.size() << " elements, got " << actual.size();
+        return;
+    }
+    for (size_t i = 0; i < actual.size(); i++) {
+        if (actual[i] != expected[i]) {
+            LOG(ERROR) << "Mismatch at index " << i << ": expected " << expected[i] << ", got " << actual[i];
+            return;
+        }
+    }
+    LOG(INFO) << "Tests passed. All " << actual.size() << " elements are in order.";
+}
+
+/**
+ * The index file must not start with the prefix, or FindFiles would take it for a file of the dataset
+ */
+std::string GetIndexName(const std::string &prefix) {
+    return GetSSDList()[0] + "/sparse_index." + prefix;
+}
+
+void RunIndexed(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " run_indexed <input prefix> <output prefix>";
+        return;
+    }
+    std::string input_prefix(argv[2]), output_prefix(argv[3]);
+    auto input_files = FindFiles(input_prefix);
+    SampleSort<size_t> sorter;
+    SparseIndex<size_t> index;
+    parlay::internal::timer timer("Sample sort with sparse index");
+    sorter.Sort(input_files, output_prefix, std::less<size_t>(), index);
+    index.Save(GetIndexName(output_prefix));
+    timer.next("DONE");
+    std::cout << "Index blocks: " << index.NumBlocks() << '\n';
+}
+
+void BuildIndex(int argc, char **argv) {
+    if (argc < 3) {
+        LOG(ERROR) << "Usage: " << argv[0] << " index <sorted prefix> [block size]";
+        return;
+    }
+    std::string prefix(argv[2]);
+    auto files = FindFiles(prefix);
+    GetFileInfo(files, true);
+    SparseIndex<size_t> index({}, argc > 3 ? ParseLong(argv[3]) : O_DIRECT_MULTIPLE);
+    parlay::internal::timer timer("Sparse index");
+    index.Build(files);
+    index.Save(GetIndexName(prefix));
+    timer.next("DONE");
+    std::cout << "Index blocks: " << index.NumBlocks() << '\n';
+}
+
+void Lookup(int argc, char **argv) {
+    if (argc < 4) {
+        LOG(ERROR) << "Usage: " << argv[0] << " lookup <sorted prefix> <key> [key ...]";
+        return;
+    }
+    SparseIndex<size_t> index;
+    index.Load(GetIndexName(argv[2]));
+    parlay::sequence<size_t> keys;
+    for (int i = 3; i < argc; i++) {
+        keys.push_back(ParseLong(argv[i]));
+    }
+    auto [positions, values] = index.LowerBounds(keys);
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::cout << keys[i] << ": " << (values[i] && *values[i] == keys[i] ? "found" : "not found")
+                  << " at position " << positions[i] << '\n';
+    }
+}
+
+void RangeScan(int argc, char **argv) {
+    if (argc < 5) {
+        LOG(ERROR) << "Usage: " << argv[0] << " range_scan <sorted prefix> <low> <high>";
+        return;
+    }
+    SparseIndex<size_t> index;
+    index.Load(GetIndexName(argv[2]));
+    parlay::internal::timer timer("Range scan");
+    auto result = index.RangeScan(ParseLong(argv[3]), ParseLong(argv[4]));
+    timer.next("DONE");
+    std::cout << result.size() << " elements in range\n";
+}
+
+/**
+ * Check random lookups and range scans through the saved index against a binary search over the whole dataset
+ */
+void VerifyIndex(int argc, char **argv) {
+    if (argc < 3) {
+        LOG(ERROR) << "Usage: " << argv[0] << " verify_index <sorted prefix> [number of probes]";
+        return;
+    }
+    SparseIndex<size_t> index;
+    index.Load(GetIndexName(argv[2]));
+    size_t num_probes = argc > 3 ? ParseLong(argv[3]) : 100000;
+    auto data = ReadSequence<size_t>(index.Files());
+    if (data.empty()) {
+        LOG(ERROR) << "The dataset is empty";
+        return;
+    }
+    // half of the probes are elements of the dataset, the other half are arbitrary values
+    std::mt19937_64 rng(42);
+    parlay::sequence<size_t> keys(num_probes);
+    for (size_t i = 0; i < num_probes; i++) {
+        keys[i] = i % 2 == 0 ? data[rng() % data.size()] : data.front() + rng() % (data.back() - data.front() + 2);
+    }
+    auto [positions, values] = index.LowerBounds(keys);
+    for (size_t i = 0; i < num_probes; i++) {
+        size_t expected = std::lower_bound(data.begin(), data.end(), keys[i]) - data.begin();
+        bool value_matches = expected == data.size() ? !values[i] : values[i] && *values[i] == data[expected];
+        if (positions[i] != expected || !value_matches) {
+            LOG(ERROR) << "Lower bound of " << keys[i] << ": expected position " << expected << ", got "
+                       << positions[i];
+            return;
+        }
+    }
+    for (size_t i = 0; i + 1 < std::min(num_probes, 100UL); i += 2) {
+        size_t low = std::min(keys[i], keys[i + 1]), high = std::max(keys[i], keys[i + 1]);
+        auto result = index.RangeScan(low, high);
+        auto begin = std::lower_bound(data.begin(), data.end(), low);
+        auto end = std::lower_bound(data.begin(), data.end(), high);
+        if (result.size() != (size_t) (end - begin) || !std::equal(result.begin(), result.end(), begin)) {
+            LOG(ERROR) << "Range scan of [" << low << ", " << high << ") returned " << result.size()
+                       << " elements; expected " << end - begin;
+            return;
+        }
+    }
+    LOG(INFO) << "Tests passed. " << num_probes << " lookups and range scans match the data.";
+}
+
 void verify_result(int argc, char **argv) {
     if (argc < 5) {
         LOG(ERROR) << "Usage: " << argv[0] << " verify <file prefix> <large data: 1|0> <data size>";
@@ -290,7 +584,20 @@ int main(int argc, char **argv) {
             {
                     {"gen",    generate},
                     {"run",    RunTest},
-                    {"verify", verify_result}
+                    {"verify", verify_result},
+                    {"rank",   RunRank},
+                    {"verify_rank", VerifyRank},
+                    {"select", RunSelect},
+                    {"verify_select", VerifySelect},
+                    {"create", CreateDataset},
+                    {"append", AppendToDataset},
+                    {"compact", CompactDataset},
+                    {"verify_dataset", VerifyDataset},
+                    {"run_indexed", RunIndexed},
+                    {"index", BuildIndex},
+                    {"lookup", Lookup},
+                    {"range_scan", RangeScan},
+                    {"verify_index", VerifyIndex}
             }
     );
     if (commands.count(argv[1])) {
@@ -0,0 +1,150 @@
+#ifndef SORTING_DISTINCT_H
+#define SORTING_DISTINCT_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+
+/**
+ * Remove duplicate elements without sorting.
+ *
+ * Phase 1 of ScatterGather hash-partitions the elements, so all copies of a value land in the same bucket. Before a
+ * chunk is assigned, every worker passes it through a small direct-mapped filter that remembers the last value seen in
+ * each slot and drops repeats of it; on inputs dominated by a few hot values, most duplicates are never written to the
+ * buckets. Phase 2 removes the remaining duplicates of each bucket with a hash set; buckets are processed in parallel.
+ *
+ * @tparam T Type of the elements; must be hashable with absl::Hash and comparable with ==
+ */
+template<typename T>
+class Distinct {
+public:
+    /**
+     * @return Files holding every distinct value once, in no particular order. Every file ends with an end-of-file
+     * marker.
+     */
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files, const std::string &result_prefix) {
+        parlay::internal::timer timer("Distinct", true);
+        auto buckets = Partition(input_files);
+        timer.next("Phase 1 done");
+        std::vector<FileInfo> results(buckets.size());
+        parlay::parallel_for(0, buckets.size(), [&](size_t i) {
+            T *buffer = ReadBucket(buckets[i]);
+            size_t true_size = DedupBucket(buffer, buckets[i].true_size / sizeof(T)) * sizeof(T);
+            std::string target_file = GetFileName(result_prefix, i);
+            size_t file_size = WriteFileWithEndMarker(target_file, buffer, true_size);
+            free(buffer);
+            results[i] = {target_file, i, true_size, file_size};
+        }, 1);
+        ComputeBeforeSize(results);
+        timer.next("Buckets deduplicated");
+        timer.stop();
+        return results;
+    }
+
+    /**
+     * @return Number of distinct values; nothing is written besides the buckets of phase 1
+     */
+    size_t Count(std::vector<FileInfo> &input_files) {
+        parlay::internal::timer timer("Distinct count", true);
+        auto buckets = Partition(input_files);
+        timer.next("Phase 1 done");
+        std::atomic<size_t> count = 0;
+        parlay::parallel_for(0, buckets.size(), [&](size_t i) {
+            T *buffer = ReadBucket(buckets[i]);
+            count += DedupBucket(buffer, buckets[i].true_size / sizeof(T));
+            free(buffer);
+        }, 1);
+        timer.next("Buckets counted");
+        timer.stop();
+        return count;
+    }
+
+private:
+    // slots of the per-worker filter; small enough to stay in the L2 cache
+    static constexpr size_t FILTER_SLOTS = 1 << 14;
+
+    static std::vector<FileInfo> Partition(std::vector<FileInfo> &input_files) {
+        GetFileInfo(input_files);
+        size_t input_size = 0;
+        for (const auto &f: input_files) {
+            input_size += f.true_size;
+        }
+        // every worker needs to fit a bucket in memory in phase 2
+        size_t num_buckets = std::max(1UL, 4 * parlay::num_workers() * input_size / MAIN_MEMORY_SIZE);
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        const auto assigner = [&](const T *data, size_t n, size_t index_start, size_t *buckets) {
+            for (size_t i = 0; i < n; i++) {
+                buckets[i] = HashToBucket(absl::Hash<T>()(data[i]), num_buckets);
+            }
+        };
+        const auto filter_factory = []() {
+            // the last value seen in each slot; a repeat of it is dropped, anything else replaces it
+            auto slots = std::make_shared<std::vector<T>>(FILTER_SLOTS);
+            auto used = std::make_shared<std::vector<bool>>(FILTER_SLOTS, false);
+            return [slots, used](T *data, size_t n, bool flush) {
+                size_t count = 0;
+                for (size_t i = 0; i < n; i++) {
+                    size_t slot = absl::Hash<T>()(data[i]) % FILTER_SLOTS;
+                    if (!(*used)[slot] || !((*slots)[slot] == data[i])) {
+                        (*used)[slot] = true;
+                        (*slots)[slot] = data[i];
+                        data[count++] = data[i];
+                    }
+                }
+                return count;
+            };
+        };
+        ScatterGather<T> scatter_gather;
+        auto buckets = scatter_gather.Scatter(input_files, assigner, filter_factory, config);
+        size_t bucket_size = 0;
+        for (const auto &b: buckets) {
+            bucket_size += b.true_size;
+        }
+        LOG(INFO) << "Distinct: " << num_buckets << " buckets; the phase 1 filter dropped "
+                  << input_size - bucket_size << " of " << input_size << " bytes";
+        return buckets;
+    }
+
+    /**
+     * @return The contents of a bucket in a buffer that also has room for an end-of-file marker
+     */
+    static T *ReadBucket(const FileInfo &bucket) {
+        if (bucket.true_size == 0) {
+            return (T *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, O_DIRECT_MULTIPLE);
+        }
+        return (T *) ReadEntireFile(bucket.file_name, bucket.file_size);
+    }
+
+    /**
+     * Move the first copy of every value to the front of the buffer
+     *
+     * @return Number of distinct values
+     */
+    static size_t DedupBucket(T *data, size_t n) {
+        absl::flat_hash_set<T> seen;
+        seen.reserve(n);
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (seen.insert(data[i]).second) {
+                data[count++] = data[i];
+            }
+        }
+        return count;
+    }
+};
+
+#endif //SORTING_DISTINCT_H
@@ -0,0 +1,282 @@
+#ifndef SORTING_HASH_INDEX_H
+#define SORTING_HASH_INDEX_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/logger.h"
+#include "utils/random_read.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+
+/**
+ * A hash of the bytes of a key that is the same in every process. absl::Hash is seeded per process, so it cannot place
+ * keys in a layout that outlives the process.
+ */
+template<typename Key>
+uint64_t StableHash(const Key &key) {
+    static_assert(std::has_unique_object_representations_v<Key>, "Keys must not contain padding");
+    uint64_t hash = sizeof(Key);
+    const auto *bytes = (const unsigned char *) &key;
+    for (size_t i = 0; i < sizeof(Key); i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, std::min(sizeof(uint64_t), sizeof(Key) - i));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15UL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/**
+ * A static on-disk hash index for looking up elements of an unsorted dataset by key.
+ *
+ * Keys are hashed to 4 KiB pages that are filled to about LOAD_FACTOR of their capacity, so a lookup usually costs a
+ * single aligned read. A page that receives more elements than it can hold is chained to overflow pages, which are
+ * stored after the primary pages of the same file.
+ *
+ * The index is bulk-built with ScatterGather: phase 1 sends every element to the partition that owns its page, where a
+ * partition is a contiguous range of pages that a worker lays out in memory. Every partition becomes one file. Lookups
+ * are batched; every round reads the distinct pages that the pending keys need through RandomBatchReadRanges, and only
+ * keys that continue into an overflow page take another round.
+ *
+ * @tparam T Type of the elements; must be trivially copyable
+ * @tparam Key Type of the keys; must be trivially copyable without padding (see StableHash) and comparable with ==
+ */
+template<typename T, typename Key>
+class HashIndex {
+public:
+    /**
+     * Build the index over a dataset and write its pages to files with the given prefix
+     *
+     * @param key <code>Key key(const T &)</code>
+     */
+    template<typename KeyFunction>
+    void Build(std::vector<FileInfo> &input_files, const std::string &result_prefix, KeyFunction key) {
+        parlay::internal::timer timer("Hash index", true);
+        GetFileInfo(input_files);
+        size_t n = 0;
+        for (const auto &f: input_files) {
+            n += f.true_size / sizeof(T);
+        }
+        num_pages = std::max(1UL, (size_t) std::ceil((double) n / (PAGE_CAPACITY * LOAD_FACTOR)));
+        // every worker lays out one partition in memory at a time
+        size_t num_partitions = std::max(1UL, 4 * parlay::num_workers() * num_pages * PAGE_SIZE / MAIN_MEMORY_SIZE);
+        pages_per_partition = (num_pages + num_partitions - 1) / num_partitions;
+        num_partitions = (num_pages + pages_per_partition - 1) / pages_per_partition;
+
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_partitions;
+        const auto assigner = [&](const T *data, size_t count, size_t index_start, size_t *buckets) {
+            for (size_t i = 0; i < count; i++) {
+                buckets[i] = GetPage(key(data[i])) / pages_per_partition;
+            }
+        };
+        ScatterGather<T> scatter_gather;
+        auto buckets = scatter_gather.Scatter(input_files, assigner, config);
+        timer.next("Phase 1 done");
+
+        files.assign(num_partitions, FileInfo());
+        std::atomic<size_t> overflow_pages = 0;
+        parlay::parallel_for(0, num_partitions, [&](size_t p) {
+            overflow_pages += WritePartition(buckets[p], p, GetFileName(result_prefix, p), key);
+        }, 1);
+        ComputeBeforeSize(files);
+        LOG(INFO) << "Hash index: " << num_pages << " pages of up to " << PAGE_CAPACITY << " elements in "
+                  << num_partitions << " files; " << overflow_pages << " overflow pages";
+        timer.next("Pages written");
+        timer.stop();
+    }
+
+    /**
+     * @return For each key, an element with that key, if there is one
+     */
+    template<typename KeyFunction>
+    parlay::sequence<std::optional<T>> Lookup(const parlay::sequence<Key> &keys, KeyFunction key) const {
+        parlay::sequence<std::optional<T>> results(keys.size());
+        // global offset of the next page to search for every key
+        auto offsets = parlay::map(keys, [&](const Key &k) {
+            size_t page = GetPage(k), p = page / pages_per_partition;
+            return files[p].before_size + (page - p * pages_per_partition) * PAGE_SIZE;
+        });
+        auto pending = parlay::iota(keys.size());
+        while (!pending.empty()) {
+            auto to_read = parlay::sort(parlay::map(pending, [&](size_t i) { return offsets[i]; }));
+            to_read.erase(std::unique(to_read.begin(), to_read.end()), to_read.end());
+            auto pages = (unsigned char *) std::aligned_alloc(PAGE_SIZE, std::max(1UL, to_read.size()) * PAGE_SIZE);
+            RandomBatchReadRanges(files, parlay::map(to_read, [](size_t offset) {
+                return std::make_pair(offset, PAGE_SIZE);
+            }), pages);
+            parlay::parallel_for(0, pending.size(), [&](size_t j) {
+                size_t i = pending[j];
+                size_t slot = std::lower_bound(to_read.begin(), to_read.end(), offsets[i]) - to_read.begin();
+                const unsigned char *page = pages + slot * PAGE_SIZE;
+                PageHeader header;
+                memcpy(&header, page, sizeof(PageHeader));
+                const T *records = (const T *) (page + RECORD_OFFSET);
+                for (size_t r = 0; r < header.count; r++) {
+                    if (key(records[r]) == keys[i]) {
+                        results[i] = records[r];
+                        offsets[i] = DONE;
+                        return;
+                    }
+                }
+                if (header.next == NO_PAGE) {
+                    offsets[i] = DONE;
+                } else {
+                    const FileInfo &file = GetFile(offsets[i]);
+                    offsets[i] = file.before_size + header.next * PAGE_SIZE;
+                }
+            });
+            free(pages);
+            pending = parlay::filter(pending, [&](size_t i) { return offsets[i] != DONE; });
+        }
+        return results;
+    }
+
+    void Save(const std::string &file_name) const {
+        std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+        const auto write = [&](size_t value) {
+            out.write((const char *) &value, sizeof(value));
+        };
+        write(num_pages);
+        write(pages_per_partition);
+        write(files.size());
+        for (const auto &f: files) {
+            write(f.file_name.size());
+            out.write(f.file_name.data(), (std::streamsize) f.file_name.size());
+            write(f.true_size);
+        }
+        CHECK(out.good()) << "Cannot write " << file_name;
+    }
+
+    void Load(const std::string &file_name) {
+        std::ifstream in(file_name, std::ios::binary);
+        CHECK(in.good()) << "Cannot read " << file_name;
+        const auto read = [&]() {
+            size_t value = 0;
+            in.read((char *) &value, sizeof(value));
+            return value;
+        };
+        num_pages = read();
+        pages_per_partition = read();
+        files.resize(read());
+        for (size_t i = 0; i < files.size(); i++) {
+            auto &f = files[i];
+            f.file_name.resize(read());
+            in.read(f.file_name.data(), (std::streamsize) f.file_name.size());
+            f.file_index = i;
+            f.true_size = f.file_size = read();
+        }
+        CHECK(!in.fail()) << "Malformed index " << file_name;
+        ComputeBeforeSize(files);
+    }
+
+    [[nodiscard]] const std::vector<FileInfo> &Files() const {
+        return files;
+    }
+
+private:
+    static constexpr size_t PAGE_SIZE = O_DIRECT_MULTIPLE;
+
+    struct PageHeader {
+        uint32_t count;
+        // page of the same file that continues this one
+        uint32_t next;
+    };
+
+    static constexpr uint32_t NO_PAGE = UINT32_MAX;
+    static constexpr size_t RECORD_OFFSET = (sizeof(PageHeader) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr size_t PAGE_CAPACITY = (PAGE_SIZE - RECORD_OFFSET) / sizeof(T);
+    static_assert(PAGE_CAPACITY > 0, "An element must fit in a page");
+    // expected fill of the primary pages; leaves room for the variance of the number of keys per page
+    static constexpr double LOAD_FACTOR = 0.8;
+    static constexpr size_t DONE = SIZE_MAX;
+
+    size_t num_pages = 0;
+    size_t pages_per_partition = 1;
+    // one file per partition; true_size is the size of its pages
+    std::vector<FileInfo> files;
+
+    size_t GetPage(const Key &k) const {
+        return HashToBucket(StableHash(k), num_pages);
+    }
+
+    const FileInfo &GetFile(size_t offset) const {
+        return *(std::upper_bound(files.begin(), files.end(), offset, [](size_t o, const FileInfo &f) {
+            return o < f.before_size + f.true_size;
+        }));
+    }
+
+    /**
+     * Lay out the pages of a partition and write them to a file
+     *
+     * @return Number of overflow pages
+     */
+    template<typename KeyFunction>
+    size_t WritePartition(const FileInfo &bucket, size_t partition, const std::string &target_file,
+                          KeyFunction key) {
+        size_t n = bucket.true_size / sizeof(T);
+        T *records = n == 0 ? nullptr : (T *) ReadEntireFile(bucket.file_name, bucket.file_size);
+        size_t first_page = partition * pages_per_partition;
+        size_t local_pages = std::min(pages_per_partition, num_pages - first_page);
+        std::vector<size_t> pages(n), counts(local_pages, 0);
+        for (size_t i = 0; i < n; i++) {
+            pages[i] = GetPage(key(records[i])) - first_page;
+            counts[pages[i]]++;
+        }
+        // the overflow pages of each page follow the primary pages, in page order
+        std::vector<size_t> first_overflow(local_pages);
+        size_t total_pages = local_pages;
+        for (size_t page = 0; page < local_pages; page++) {
+            first_overflow[page] = total_pages;
+            if (counts[page] > PAGE_CAPACITY) {
+                total_pages += (counts[page] - 1) / PAGE_CAPACITY;
+            }
+        }
+        CHECK(total_pages < NO_PAGE) << "Too many pages in " << target_file;
+        auto buffer = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, total_pages * PAGE_SIZE);
+        memset(buffer, 0, total_pages * PAGE_SIZE);
+        const auto get_page = [&](size_t page, size_t link) {
+            return link == 0 ? page : first_overflow[page] + link - 1;
+        };
+        for (size_t page = 0; page < local_pages; page++) {
+            size_t links = std::max(1UL, (counts[page] + PAGE_CAPACITY - 1) / PAGE_CAPACITY);
+            for (size_t link = 0; link < links; link++) {
+                PageHeader header{(uint32_t) std::min(PAGE_CAPACITY, counts[page] - link * PAGE_CAPACITY),
+                                  link + 1 < links ? (uint32_t) get_page(page, link + 1) : NO_PAGE};
+                memcpy(buffer + get_page(page, link) * PAGE_SIZE, &header, sizeof(PageHeader));
+            }
+            counts[page] = 0;
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t slot = counts[pages[i]]++;
+            size_t page = get_page(pages[i], slot / PAGE_CAPACITY);
+            memcpy(buffer + page * PAGE_SIZE + RECORD_OFFSET + slot % PAGE_CAPACITY * sizeof(T), &records[i],
+                   sizeof(T));
+        }
+        free(records);
+        int fd = open(target_file.c_str(), O_WRONLY | O_DIRECT | O_CREAT | O_TRUNC, 0644);
+        SYSCALL(fd);
+        Write(fd, buffer, total_pages * PAGE_SIZE);
+        SYSCALL(close(fd));
+        free(buffer);
+        files[partition] = {target_file, partition, total_pages * PAGE_SIZE, total_pages * PAGE_SIZE};
+        return total_pages - local_pages;
+    }
+};
+
+#endif //SORTING_HASH_INDEX_H
@@ -0,0 +1,376 @@
+#ifndef SORTING_HASH_JOIN_H
+#define SORTING_HASH_JOIN_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include <algorithm>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/bloom_filter.h"
+#include "utils/file_utils.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+
+/**
+ * Equi-join of two datasets on a key extracted from each side.
+ *
+ * Phase 1 of ScatterGather partitions both inputs with the same hash of the key, so partition i of the left input can
+ * only match partition i of the right input. Phase 2 joins the partition pairs one at a time, using every worker:
+ * both sides are split again by hash into small sub-partitions, and each sub-partition builds a hash table on its
+ * smaller side and probes it with the other. The next pair is read from disk while the current one is joined.
+ *
+ * If one input is much smaller than the other, its keys are collected in a blocked Bloom filter while it is
+ * partitioned, and the larger input is probed against the filter as its chunks are read, so most elements without a
+ * match never reach the buckets.
+ *
+ * A pair that is too large for memory (because of skew or an unlucky hash) is partitioned again with a different hash,
+ * up to MAX_DEPTH times. Partitioning cannot split a single key, so a partition that is still too large at that point
+ * is joined in memory anyway.
+ *
+ * @tparam L Type of the left elements
+ * @tparam R Type of the right elements
+ * @tparam Key Type of the join key; must be hashable with absl::Hash
+ */
+template<typename L, typename R, typename Key>
+class HashJoin {
+public:
+    typedef std::pair<L, R> Output;
+
+    /**
+     * @param left_key <code>Key left_key(const L &)</code>
+     * @param right_key <code>Key right_key(const R &)</code>
+     * @return Files holding one Output per matching (left, right) pair, in no particular order. Every file ends with
+     * an end-of-file marker. The output of one partition pair is assembled in memory before it is written.
+     */
+    template<typename LeftKey, typename RightKey>
+    std::vector<FileInfo> Run(std::vector<FileInfo> &left_files, std::vector<FileInfo> &right_files,
+                              const std::string &result_prefix, LeftKey left_key, RightKey right_key) {
+        parlay::internal::timer timer("Hash join", true);
+        GetFileInfo(left_files);
+        GetFileInfo(right_files);
+        size_t left_size = TotalSize(left_files), right_size = TotalSize(right_files);
+        size_t num_partitions = std::max(1UL, (left_size + right_size + TARGET_PARTITION_SIZE - 1)
+                                              / TARGET_PARTITION_SIZE);
+        // when one side is much smaller, its keys go into a Bloom filter as it is partitioned, and elements of the
+        // other side that cannot match are dropped before they reach the buckets
+        bool left_smaller = left_size <= right_size;
+        size_t small_count = left_smaller ? left_size / sizeof(L) : right_size / sizeof(R);
+        bool use_filter = 4 * std::min(left_size, right_size) <= std::max(left_size, right_size)
+                          && small_count * FILTER_BITS_PER_KEY / 8 <= MAIN_MEMORY_SIZE / 16;
+        std::vector<FileInfo> left_partitions, right_partitions;
+        if (!use_filter) {
+            left_partitions = Partition<L>(left_files, left_key, num_partitions, 0, "hjl0_");
+            right_partitions = Partition<R>(right_files, right_key, num_partitions, 0, "hjr0_");
+        } else {
+            BlockedBloomFilter filter(small_count, FILTER_BITS_PER_KEY);
+            LOG(INFO) << "Hash join: " << filter.SizeInBytes() << " byte Bloom filter on the "
+                      << (left_smaller ? "left" : "right") << " side";
+            if (left_smaller) {
+                left_partitions = Partition<L>(left_files, left_key, num_partitions, 0, "hjl0_",
+                                               InsertInto<L>(filter, left_key));
+                right_partitions = Partition<R>(right_files, right_key, num_partitions, 0, "hjr0_",
+                                                ProbeWith<R>(filter, right_key));
+            } else {
+                right_partitions = Partition<R>(right_files, right_key, num_partitions, 0, "hjr0_",
+                                                InsertInto<R>(filter, right_key));
+                left_partitions = Partition<L>(left_files, left_key, num_partitions, 0, "hjl0_",
+                                               ProbeWith<L>(filter, left_key));
+            }
+        }
+        timer.next("Inputs partitioned");
+        std::vector<FileInfo> results;
+        JoinPartitions(left_partitions, right_partitions, result_prefix, left_key, right_key, 0, results);
+        ComputeBeforeSize(results);
+        timer.next("Partitions joined");
+        timer.stop();
+        return results;
+    }
+
+private:
+    // partitions are sized so that the current pair, its sub-partitioned copy and the prefetched pair fit in memory
+    static constexpr size_t TARGET_PARTITION_SIZE = MAIN_MEMORY_SIZE / 16;
+    // pairs larger than this are partitioned again
+    static constexpr size_t MAX_PARTITION_SIZE = MAIN_MEMORY_SIZE / 8;
+    static constexpr size_t MAX_DEPTH = 3;
+    static constexpr size_t FILTER_BITS_PER_KEY = 16;
+
+    /**
+     * A partition pair in memory
+     */
+    struct LoadedPair {
+        std::unique_ptr<L, decltype(&free)> left{nullptr, free};
+        std::unique_ptr<R, decltype(&free)> right{nullptr, free};
+        size_t left_size = 0, right_size = 0;
+    };
+
+    static size_t TotalSize(const std::vector<FileInfo> &files) {
+        size_t size = 0;
+        for (const auto &f: files) {
+            size += f.true_size;
+        }
+        return size;
+    }
+
+    /**
+     * Every level of partitioning uses a different hash, so that a partition that is partitioned again spreads out
+     */
+    static size_t GetBucket(const Key &key, size_t depth, size_t num_buckets) {
+        return HashToBucket(absl::Hash<Key>()(key) + depth * 0x9e3779b97f4a7c15UL, num_buckets);
+    }
+
+    /**
+     * Partition a dataset by the hash of its keys at the given level of partitioning
+     *
+     * @param prefix Prefix of the partition files; must differ between the two inputs and between levels
+     * @param combiner_factory If set, every chunk passes through a combiner before it is partitioned
+     */
+    template<typename T, typename KeyFunction>
+    static std::vector<FileInfo> Partition(std::vector<FileInfo> &files, KeyFunction key, size_t num_partitions,
+                                           size_t depth, const std::string &prefix,
+                                           typename ScatterGather<T>::CombinerFactory combiner_factory = nullptr) {
+        // the reader reports file_index, so number the files by their position
+        for (size_t i = 0; i < files.size(); i++) {
+            files[i].file_index = i;
+        }
+        ComputeBeforeSize(files);
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_partitions;
+        config.intermediate_prefix = prefix;
+        const auto assigner = [&](const T *data, size_t n, size_t index_start, size_t *buckets) {
+            for (size_t i = 0; i < n; i++) {
+                buckets[i] = GetBucket(key(data[i]), depth, num_partitions);
+            }
+        };
+        ScatterGather<T> scatter_gather;
+        typename ScatterGather<T>::BlockAssignerFunction block_assigner(assigner);
+        if (combiner_factory) {
+            return scatter_gather.Scatter(files, block_assigner, combiner_factory, config);
+        }
+        return scatter_gather.Scatter(files, block_assigner, config);
+    }
+
+    /**
+     * A combiner that records the key of every element in the filter and passes the element on
+     */
+    template<typename T, typename KeyFunction>
+    static typename ScatterGather<T>::CombinerFactory InsertInto(BlockedBloomFilter &filter, KeyFunction key) {
+        return [&filter, key]() {
+            return [&filter, key](T *data, size_t n, bool flush) {
+                for (size_t i = 0; i < n; i++) {
+                    filter.Insert(absl::Hash<Key>()(key(data[i])));
+                }
+                return n;
+            };
+        };
+    }
+
+    /**
+     * A combiner that only passes on the elements whose key may be in the filter
+     */
+    template<typename T, typename KeyFunction>
+    static typename ScatterGather<T>::CombinerFactory ProbeWith(const BlockedBloomFilter &filter, KeyFunction key) {
+        return [&filter, key]() {
+            return [&filter, key](T *data, size_t n, bool flush) {
+                size_t count = 0;
+                for (size_t i = 0; i < n; i++) {
+                    if (filter.MayContain(absl::Hash<Key>()(key(data[i])))) {
+                        data[count++] = data[i];
+                    }
+                }
+                return count;
+            };
+        };
+    }
+
+    static LoadedPair Load(const FileInfo &left, const FileInfo &right) {
+        LoadedPair pair;
+        pair.left_size = left.true_size / sizeof(L);
+        pair.right_size = right.true_size / sizeof(R);
+        // a pair with an empty side has no matches, so neither side is needed
+        if (pair.left_size > 0 && pair.right_size > 0) {
+            parlay::par_do([&]() {
+                pair.left.reset((L *) ReadEntireFile(left.file_name, left.file_size));
+            }, [&]() {
+                pair.right.reset((R *) ReadEntireFile(right.file_name, right.file_size));
+            });
+        }
+        return pair;
+    }
+
+    /**
+     * Join partition i of the left input with partition i of the right input, for every i. Oversized pairs are
+     * partitioned again; the others are joined in memory while the next pair is read.
+     */
+    template<typename LeftKey, typename RightKey>
+    static void JoinPartitions(std::vector<FileInfo> &left_partitions, std::vector<FileInfo> &right_partitions,
+                               const std::string &result_prefix, LeftKey left_key, RightKey right_key,
+                               size_t depth, std::vector<FileInfo> &results) {
+        CHECK(left_partitions.size() == right_partitions.size());
+        const size_t num_partitions = left_partitions.size();
+        const auto oversized = [&](size_t i) {
+            return left_partitions[i].true_size + right_partitions[i].true_size > MAX_PARTITION_SIZE;
+        };
+        const auto repartition = [&](size_t i) {
+            return depth < MAX_DEPTH && oversized(i);
+        };
+        LoadedPair current;
+        if (num_partitions > 0 && !repartition(0)) {
+            current = Load(left_partitions[0], right_partitions[0]);
+        }
+        for (size_t i = 0; i < num_partitions; i++) {
+            if (repartition(i)) {
+                size_t size = left_partitions[i].true_size + right_partitions[i].true_size;
+                // twice the minimum, since the partition was already unbalanced once
+                size_t fan_out = 2 * ((size + TARGET_PARTITION_SIZE - 1) / TARGET_PARTITION_SIZE);
+                LOG(INFO) << "Hash join: partition " << i << " at depth " << depth << " holds " << size
+                          << " bytes; partitioning it " << fan_out << " ways";
+                std::vector<FileInfo> left_input = {left_partitions[i]}, right_input = {right_partitions[i]};
+                std::string suffix = std::to_string(depth + 1) + "_";
+                auto left_sub = Partition<L>(left_input, left_key, fan_out, depth + 1, "hjl" + suffix);
+                auto right_sub = Partition<R>(right_input, right_key, fan_out, depth + 1, "hjr" + suffix);
+                JoinPartitions(left_sub, right_sub, result_prefix, left_key, right_key, depth + 1, results);
+                if (i + 1 < num_partitions && !repartition(i + 1)) {
+                    current = Load(left_partitions[i + 1], right_partitions[i + 1]);
+                }
+                continue;
+            }
+            if (oversized(i)) {
+                LOG(WARNING) << "Hash join: partition " << i << " at depth " << depth
+                             << " is still oversized; joining it in memory";
+            }
+            LoadedPair next;
+            parlay::par_do([&]() {
+                if (i + 1 < num_partitions && !repartition(i + 1)) {
+                    next = Load(left_partitions[i + 1], right_partitions[i + 1]);
+                }
+            }, [&]() {
+                auto output = JoinInMemory(current, left_key, right_key);
+                if (!output.empty()) {
+                    results.push_back(WriteOutput(output, GetFileName(result_prefix, results.size()),
+                                                  results.size()));
+                }
+            });
+            current = std::move(next);
+        }
+    }
+
+    /**
+     * Group elements by the sub-partition of their key with a parallel counting sort
+     *
+     * @return The grouped elements and the offset of every sub-partition (with a trailing total)
+     */
+    template<typename T, typename KeyFunction>
+    static std::pair<parlay::sequence<T>, parlay::sequence<size_t>>
+    SubPartition(const T *data, size_t n, KeyFunction key, size_t num_sub_partitions) {
+        CHECK(n > 0);
+        constexpr size_t BLOCK_SIZE = 1 << 14;
+        // sub-partitions use a hash that no level of partitioning uses
+        auto bucket = parlay::tabulate(n, [&](size_t i) {
+            return (uint32_t) GetBucket(key(data[i]), MAX_DEPTH + 1, num_sub_partitions);
+        });
+        size_t num_blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        // counts[s * num_blocks + b] is the number of elements of block b in sub-partition s
+        parlay::sequence<size_t> counts(num_sub_partitions * num_blocks + 1, 0);
+        parlay::parallel_for(0, num_blocks, [&](size_t b) {
+            for (size_t i = b * BLOCK_SIZE; i < std::min(n, (b + 1) * BLOCK_SIZE); i++) {
+                counts[bucket[i] * num_blocks + b]++;
+            }
+        }, 1);
+        parlay::scan_inplace(counts);
+        auto grouped = parlay::sequence<T>::uninitialized(n);
+        parlay::parallel_for(0, num_blocks, [&](size_t b) {
+            for (size_t i = b * BLOCK_SIZE; i < std::min(n, (b + 1) * BLOCK_SIZE); i++) {
+                grouped[counts[bucket[i] * num_blocks + b]++] = data[i];
+            }
+        }, 1);
+        // after the scatter, the counter of the last block of s - 1 holds the start of s
+        auto offsets = parlay::tabulate(num_sub_partitions + 1, [&](size_t s) {
+            return s == 0 ? 0 : counts[s * num_blocks - 1];
+        });
+        return {std::move(grouped), std::move(offsets)};
+    }
+
+    /**
+     * Build a hash table on build and probe it with every element of probe
+     *
+     * @param emit <code>void emit(const B &, const P &)</code>
+     */
+    template<typename B, typename P, typename BuildKey, typename ProbeKey, typename Emit>
+    static void BuildAndProbe(const B *build, size_t build_size, const P *probe, size_t probe_size,
+                              BuildKey build_key, ProbeKey probe_key, Emit emit) {
+        // the matches of a key are a contiguous range of the build side once it is grouped by key
+        absl::flat_hash_map<Key, std::pair<size_t, size_t>> table;
+        table.reserve(build_size);
+        for (size_t i = 0; i < build_size; i++) {
+            table[build_key(build[i])].second++;
+        }
+        size_t offset = 0;
+        for (auto &[k, range]: table) {
+            range.first = offset;
+            offset += range.second;
+            range.second = range.first;
+        }
+        std::vector<B> grouped(build_size);
+        for (size_t i = 0; i < build_size; i++) {
+            grouped[table[build_key(build[i])].second++] = build[i];
+        }
+        for (size_t i = 0; i < probe_size; i++) {
+            auto it = table.find(probe_key(probe[i]));
+            if (it != table.end()) {
+                for (size_t j = it->second.first; j < it->second.second; j++) {
+                    emit(grouped[j], probe[i]);
+                }
+            }
+        }
+    }
+
+    template<typename LeftKey, typename RightKey>
+    static parlay::sequence<Output> JoinInMemory(const LoadedPair &pair, LeftKey left_key, RightKey right_key) {
+        if (pair.left_size == 0 || pair.right_size == 0) {
+            return {};
+        }
+        // enough sub-partitions to balance the workers, each small enough to keep its hash table in cache
+        size_t num_sub_partitions = std::max(8 * parlay::num_workers(),
+                                             (pair.left_size * sizeof(L) + pair.right_size * sizeof(R)) / (1 << 20));
+        auto [left, left_offsets] = SubPartition(pair.left.get(), pair.left_size, left_key, num_sub_partitions);
+        auto [right, right_offsets] = SubPartition(pair.right.get(), pair.right_size, right_key, num_sub_partitions);
+        auto outputs = parlay::tabulate(num_sub_partitions, [&](size_t s) {
+            const L *l = left.data() + left_offsets[s];
+            const R *r = right.data() + right_offsets[s];
+            size_t l_size = left_offsets[s + 1] - left_offsets[s], r_size = right_offsets[s + 1] - right_offsets[s];
+            parlay::sequence<Output> output;
+            if (l_size <= r_size) {
+                BuildAndProbe(l, l_size, r, r_size, left_key, right_key, [&](const L &a, const R &b) {
+                    output.push_back(Output(a, b));
+                });
+            } else {
+                BuildAndProbe(r, r_size, l, l_size, right_key, left_key, [&](const R &b, const L &a) {
+                    output.push_back(Output(a, b));
+                });
+            }
+            return output;
+        }, 1);
+        return parlay::flatten(outputs);
+    }
+
+    static FileInfo WriteOutput(const parlay::sequence<Output> &output, const std::string &target_file,
+                                size_t file_index) {
+        size_t true_size = output.size() * sizeof(Output);
+        auto buffer = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT,
+                                                           AlignUp(true_size + METADATA_SIZE));
+        std::copy((const unsigned char *) output.data(), (const unsigned char *) output.data() + true_size, buffer);
+        size_t file_size = WriteFileWithEndMarker(target_file, buffer, true_size);
+        free(buffer);
+        return {target_file, file_index, true_size, file_size};
+    }
+};
+
+#endif //SORTING_HASH_JOIN_H
@@ -7,12 +7,19 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <numeric>
+#include <atomic>
+#include <random>
+#include <limits>
+#include <cstring>
 
 #include "parlay/primitives.h"
 #include "parlay/internal/get_time.h"
 
 #include "configs.h"
 #include "utils/file_utils.h"
+#include "utils/unordered_file_writer.h"
 
 #include "scatter_gather.h"
 
@@ -47,32 +54,210 @@ private:
         return std::max(std::min(file_size / (1UL << 27), max_sample_size), min_sample_size);
     }
 
+    /**
+     * Number of destinations covered by each bucket of ApplyPermutation. A bucket's output is always a whole number
+     * of disk blocks so that it can be written with O_DIRECT at its final offset.
+     *
+     * @param n Number of elements
+     */
+    static size_t GetRangeSize(size_t n) {
+        using Record = IndexedElement<T>;
+        // smallest number of elements that occupies a whole number of blocks
+        constexpr size_t unit = O_DIRECT_MULTIPLE / std::gcd(O_DIRECT_MULTIPLE, sizeof(T));
+        size_t bucket_bytes = n * sizeof(Record);
+        // same considerations as GetBucketSize: ~128MB per bucket, but enough buckets for all workers to fit in memory
+        size_t min_buckets = std::max(1UL, 4 * parlay::num_workers() * bucket_bytes / MAIN_MEMORY_SIZE);
+        size_t num_buckets = std::max(bucket_bytes / (1UL << 27), min_buckets);
+        return AlignUp((n + num_buckets - 1) / num_buckets, unit);
+    }
+
+    /**
+     * Counter-based generator (SplitMix64 finalizer). The i-th number of a stream only depends on the seed and i, so
+     * any chunk can be generated independently of the others and the loop over a chunk vectorizes.
+     */
+    static inline uint64_t RandomBits(uint64_t seed, uint64_t counter) {
+        uint64_t z = seed + counter * 0x9E3779B97F4A7C15UL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * Map the upper 32 random bits to [0, range) with a multiply-shift instead of a division or a rejection loop.
+     * The bias is at most range / 2^32, which is negligible for bucket counts.
+     */
+    static inline size_t ReduceRange(uint64_t bits, uint64_t range) {
+        return (size_t) (((bits >> 32) * range) >> 32);
+    }
+
+    /**
+     * Generate the bucket of every element in a chunk at once. Buckets only depend on the seed and global indices.
+     */
+    static auto MakeAssigner(size_t seed, size_t num_buckets) {
+        CHECK(num_buckets <= std::numeric_limits<uint32_t>::max());
+        return [=](const T *, size_t n, size_t index_start, size_t *result) {
+            for (size_t i = 0; i < n; i++) {
+                result[i] = ReduceRange(RandomBits(seed, index_start + i), num_buckets);
+            }
+        };
+    }
+
 public:
 
+    /**
+     * Randomly permute the input. Every run uses a different seed.
+     */
     std::vector<FileInfo> Permute(std::vector<FileInfo> &input_files,
                                   const std::string &result_prefix) {
         GetFileInfo(input_files);
         ComputeBeforeSize(input_files);
         size_t num_buckets = GetBucketSize(input_files);
-        ScatterGather<T> scatter_gather;
-        parlay::random_generator gen;
-        std::uniform_int_distribution<size_t> dist(0, num_buckets - 1);
-        const auto simple_assigner = [&](const T &t, size_t index) {
-            auto r = gen[index];
-            return dist(r);
-        };
-        const auto simple_processor = [&](T **buffer, size_t n) {
+        std::random_device device;
+        const size_t seed = ((size_t) device() << 32) | device();
+        std::atomic<size_t> bucket_counter = 0;
+        const auto processor = [&](T **buffer, size_t n) {
             T *ptr = *buffer;
             auto seq = parlay::make_slice(ptr, ptr + n);
-            parlay::random_shuffle(seq);
+            auto shuffled = parlay::random_shuffle(seq, parlay::random_generator(RandomBits(~seed, bucket_counter++)));
+            parlay::copy(shuffled, seq);
+        };
+        ScatterGather<T> scatter_gather;
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        return scatter_gather.Run(input_files, result_prefix, MakeAssigner(seed, num_buckets), processor, config);
+    }
+
+    /**
+     * Reproducible version of Permute: the same seed and input always produce the same output.
+     *
+     * Elements reach their bucket in an arbitrary order, so each element carries its global index and buckets are
+     * ordered by a random key derived from that index. This doubles the size of the intermediate buckets for 8-byte
+     * types, so it is slower than the unseeded version.
+     */
+    std::vector<FileInfo> Permute(std::vector<FileInfo> &input_files,
+                                  const std::string &result_prefix,
+                                  size_t seed) {
+        using Record = IndexedElement<T>;
+        GetFileInfo(input_files);
+        ComputeBeforeSize(input_files);
+        size_t num_buckets = GetBucketSize(input_files);
+        const size_t order_seed = RandomBits(seed, -1);
+        const auto processor = [&](Record **buffer, size_t n) {
+            Record *ptr = *buffer;
+            auto seq = parlay::make_slice(ptr, ptr + n);
+            // RandomBits is a bijection for a fixed seed, so there are no ties
+            parlay::sort_inplace(seq, [&](const Record &a, const Record &b) {
+                return RandomBits(order_seed, a.index) < RandomBits(order_seed, b.index);
+            });
+            auto values = parlay::map(seq, [](const Record &r) { return r.value; });
+            memcpy(ptr, values.data(), n * sizeof(T));
         };
+        ScatterGather<T, Record, T> scatter_gather;
         ScatterGatherConfig config;
-        config.bucketed_writer_config.num_buckets = num_buckets + 1;
-        auto results = scatter_gather.Run(input_files, result_prefix,
-                                          simple_assigner,
-                                          simple_processor,
-                                          config);
-        return {results.begin(), results.end()};
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        return scatter_gather.Run(input_files, result_prefix, MakeAssigner(seed, num_buckets), processor, config);
+    }
+
+    /**
+     * Move every element to the position given by the corresponding entry of an index dataset, i.e.
+     * <code>result[indices[i]] = values[i]</code>. Applying the output of SampleSort::Rank, for instance, sorts the
+     * values.
+     *
+     * Phase 1 reads the values and buckets them by destination range, fetching the matching indices alongside each
+     * chunk. Phase 2 scatters each bucket in memory and writes it directly to its final offset.
+     *
+     * @param values Files holding the elements; true_size must be populated
+     * @param indices Files holding one size_t per element; must be a permutation of [0, n)
+     * @param result_prefix Prefix of the output files
+     * @return Output files in order. If the total size is not a multiple of O_DIRECT_MULTIPLE, the last file is
+     * padded and its true_size records the actual amount of data.
+     */
+    std::vector<FileInfo> ApplyPermutation(std::vector<FileInfo> &values,
+                                           std::vector<FileInfo> &indices,
+                                           const std::string &result_prefix) {
+        using Record = IndexedElement<T>;
+        ComputeBeforeSize(values);
+        ComputeBeforeSize(indices);
+        size_t n = 0, num_indices = 0;
+        for (const auto &f: values) {
+            n += f.true_size / sizeof(T);
+        }
+        for (const auto &f: indices) {
+            num_indices += f.true_size / sizeof(size_t);
+        }
+        CHECK(n == num_indices) << "Got " << n << " values but " << num_indices << " indices";
+        if (n == 0) {
+            return {};
+        }
+        const size_t range_size = GetRangeSize(n);
+        const size_t num_buckets = (n + range_size - 1) / range_size;
+        const auto assigner = [&](const T &t, size_t destination) {
+            CHECK(destination < n) << "Destination " << destination << " is out of range";
+            return destination / range_size;
+        };
+        // replace the position of each element with its destination, read from the index files; they stay open for
+        // the whole phase since every chunk of values needs its own range of indices
+        const auto index_fds = OpenFiles(indices);
+        const auto index_function = [&](size_t start, size_t count, size_t *result) {
+            ReadFileRange(indices, index_fds, start * sizeof(size_t), count * sizeof(size_t), result);
+        };
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        ScatterGather<T, Record> scatter_gather;
+        auto bucket_list = scatter_gather.Scatter(values, assigner, config, index_function);
+        CloseFiles(index_fds);
+
+        // consecutive buckets go to the same file so that every file is contiguous
+        size_t num_files = std::min<size_t>(SSD_COUNT, num_buckets);
+        const size_t buckets_per_file = (num_buckets + num_files - 1) / num_files;
+        num_files = (num_buckets + buckets_per_file - 1) / buckets_per_file;
+        UnorderedWriterConfig writer_config;
+        writer_config.num_files = num_files;
+        writer_config.num_threads = num_files;
+        UnorderedFileWriter<T> writer(result_prefix, writer_config);
+        constexpr size_t unit = O_DIRECT_MULTIPLE / std::gcd(O_DIRECT_MULTIPLE, sizeof(T));
+        // split large buckets into several writes
+        constexpr size_t write_size = std::max(1UL, (1UL << 24) / (unit * sizeof(T))) * unit;
+        parlay::parallel_for(0, num_buckets, [&](size_t b) {
+            const FileInfo &bucket = bucket_list[b];
+            const size_t begin = b * range_size;
+            const size_t count = std::min(range_size, n - begin);
+            CHECK(bucket.true_size / sizeof(Record) == count)
+                << "Bucket " << b << " has " << bucket.true_size / sizeof(Record) << " elements instead of "
+                << count << ". Indices do not form a permutation.";
+            auto records = (Record *) ReadEntireFile(bucket.file_name, bucket.file_size);
+            const size_t padded_count = AlignUp(count, unit);
+            std::shared_ptr<T> output((T *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, padded_count * sizeof(T)),
+                                      free);
+            T *ptr = output.get();
+            // with as many records as destinations, writing none of them twice means writing each exactly once
+            std::vector<std::atomic<uint64_t>> written((count + 63) / 64);
+            parlay::parallel_for(0, count, [&](size_t i) {
+                const size_t offset = records[i].index - begin;
+                const uint64_t bit = 1UL << (offset % 64);
+                CHECK(!(written[offset / 64].fetch_or(bit, std::memory_order_relaxed) & bit))
+                    << "Destination " << records[i].index << " is written more than once. "
+                    << "Indices do not form a permutation.";
+                ptr[offset] = records[i].value;
+            });
+            free(records);
+            const size_t file_index = b / buckets_per_file;
+            const size_t file_offset = (b % buckets_per_file) * range_size * sizeof(T);
+            for (size_t i = 0; i < padded_count; i += write_size) {
+                writer.Push(std::shared_ptr<T>(output, ptr + i), std::min(write_size, padded_count - i),
+                            file_index, file_offset + i * sizeof(T));
+            }
+        }, 1);
+        writer.Wait();
+
+        std::vector<FileInfo> results;
+        for (size_t i = 0; i < num_files; i++) {
+            size_t begin = i * buckets_per_file * range_size;
+            size_t true_size = (std::min(n, begin + buckets_per_file * range_size) - begin) * sizeof(T);
+            results.emplace_back(GetFileName(result_prefix, i), i, true_size, AlignUp(true_size));
+        }
+        ComputeBeforeSize(results);
+        return results;
     }
 };
 
@@ -0,0 +1,135 @@
+#ifndef SORTING_REDUCE_BY_KEY_H
+#define SORTING_REDUCE_BY_KEY_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include <optional>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+
+/**
+ * Group-by aggregation over files of key-value pairs.
+ *
+ * Phase 1 of ScatterGather hash-partitions the pairs by key. Every worker passes its chunks through a combiner: a
+ * small hash table that stays in cache and folds each pair into the partial aggregate of its key. Pairs whose key
+ * does not fit in the table are passed through unchanged, and the table is flushed once the input is exhausted.
+ * For inputs with few distinct keys, the buckets therefore only hold a handful of partial aggregates per worker
+ * instead of the whole input. Phase 2 aggregates each bucket with a hash table; buckets are processed in parallel.
+ *
+ * @tparam K Key type
+ * @tparam V Value type
+ */
+template<typename K, typename V>
+class ReduceByKey {
+public:
+    typedef std::pair<K, V> Pair;
+
+    /**
+     * @param files Files of Pair; true_size must be populated
+     * @param monoid Associative operation on values (e.g. parlay::plus)
+     * @return Files holding one pair per distinct key, each with its aggregated value. Keys are in no particular
+     * order. Every file ends with an end-of-file marker.
+     */
+    template<typename Monoid>
+    std::vector<FileInfo> Run(std::vector<FileInfo> &files, const std::string &result_prefix, Monoid monoid) {
+        parlay::internal::timer timer("Reduce by key", true);
+        size_t input_size = 0;
+        for (const auto &f: files) {
+            input_size += f.true_size;
+        }
+        // size buckets as if nothing was combined, so that every worker can hold a bucket in memory in phase 2
+        size_t num_buckets = std::max(1UL, 4 * parlay::num_workers() * input_size / MAIN_MEMORY_SIZE);
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        const auto assigner = [&](const Pair *data, size_t n, size_t index_start, size_t *buckets) {
+            for (size_t i = 0; i < n; i++) {
+                buckets[i] = HashToBucket(absl::Hash<K>()(data[i].first), num_buckets);
+            }
+        };
+        const auto combiner_factory = [&]() {
+            using Table = absl::flat_hash_map<K, V>;
+            auto table = std::make_shared<Table>();
+            table->reserve(COMBINER_CAPACITY);
+            // where the previous flush call stopped; the table is not modified while flushing, so it stays valid
+            auto flush_position = std::make_shared<std::optional<typename Table::const_iterator>>();
+            return [table, flush_position, monoid](Pair *data, size_t n, bool flush) {
+                size_t emitted = 0;
+                if (flush) {
+                    constexpr size_t capacity = READER_READ_SIZE / sizeof(Pair);
+                    if (!flush_position->has_value()) {
+                        *flush_position = table->cbegin();
+                    }
+                    auto &it = **flush_position;
+                    for (; it != table->cend() && emitted < capacity; ++it) {
+                        data[emitted++] = {it->first, it->second};
+                    }
+                    return emitted;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    auto it = table->find(data[i].first);
+                    if (it != table->end()) {
+                        it->second = monoid(it->second, data[i].second);
+                    } else if (table->size() < COMBINER_CAPACITY) {
+                        table->emplace(data[i].first, data[i].second);
+                    } else {
+                        data[emitted++] = data[i];
+                    }
+                }
+                return emitted;
+            };
+        };
+        ScatterGather<Pair> scatter_gather;
+        auto buckets = scatter_gather.Scatter(files, assigner, combiner_factory, config);
+        timer.next("Partial aggregates written to buckets");
+
+        std::vector<FileInfo> results(buckets.size());
+        parlay::parallel_for(0, buckets.size(), [&](size_t i) {
+            results[i] = AggregateBucket(buckets[i], GetFileName(result_prefix, i), monoid);
+        }, 1);
+        ComputeBeforeSize(results);
+        timer.next("Buckets aggregated");
+        timer.stop();
+        return results;
+    }
+
+private:
+    // entries of the per-worker combiner; small enough to stay in the L2 cache
+    static constexpr size_t COMBINER_CAPACITY = 1 << 14;
+
+    template<typename Monoid>
+    static FileInfo AggregateBucket(const FileInfo &bucket, const std::string &target_file, Monoid monoid) {
+        // an empty bucket still needs room for the end-of-file marker
+        auto *buffer = (Pair *) (bucket.true_size == 0
+                                 ? std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, O_DIRECT_MULTIPLE)
+                                 : ReadEntireFile(bucket.file_name, bucket.file_size));
+        size_t n = bucket.true_size / sizeof(Pair);
+        absl::flat_hash_map<K, V> table;
+        for (size_t i = 0; i < n; i++) {
+            auto [it, inserted] = table.try_emplace(buffer[i].first, buffer[i].second);
+            if (!inserted) {
+                it->second = monoid(it->second, buffer[i].second);
+            }
+        }
+        size_t count = 0;
+        for (const auto &[key, value]: table) {
+            buffer[count++] = {key, value};
+        }
+        size_t true_size = count * sizeof(Pair);
+        size_t file_size = WriteFileWithEndMarker(target_file, buffer, true_size);
+        free(buffer);
+        return {target_file, bucket.file_index, true_size, file_size};
+    }
+};
+
+#endif //SORTING_REDUCE_BY_KEY_H
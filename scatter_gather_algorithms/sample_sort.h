@@ -10,6 +10,9 @@
 #include <string>
 #include <functional>
 #include <set>
+#include <map>
+#include <cmath>
+#include <algorithm>
 
 #include "parlay/primitives.h"
 #include "parlay/internal/get_time.h"
@@ -19,6 +22,8 @@
 #include "configs.h"
 #include "utils/file_utils.h"
 #include "utils/random_read.h"
+#include "utils/sparse_index.h"
+#include "utils/unordered_file_reader.h"
 
 #include "scatter_gather.h"
 
@@ -55,7 +60,7 @@ private:
         parlay::random_generator generator;
         std::uniform_int_distribution<size_t> dis(0, n - 1);
         auto samples = parlay::sort(
-                RandomBatchRead<T>(file_list, parlay::map(parlay::iota(oversample_size), [&](size_t i) {
+                RandomBatchReadCoalesced<T>(file_list, parlay::map(parlay::iota(oversample_size), [&](size_t i) {
                     auto gen = generator[i];
                     return dis(gen);
                 })));
@@ -63,7 +68,8 @@ private:
         size_t remaining_pivots = num_pivots;
         size_t i = 0;
         while (remaining_pivots > 0) {
-            i += std::max(1UL, (oversample_size - i - remaining_pivots) / (remaining_pivots + 1));
+            // i + remaining_pivots never exceeds oversample_size, so this cannot run past the end of the samples
+            i += (oversample_size - i - remaining_pivots) / (remaining_pivots + 1);
             result.push_back(samples[i]);
             // samples[i] is taken, so the first available sample is the next one
             i++;
@@ -79,7 +85,7 @@ private:
      * @param input_files List of file to be sorted
      * @return An ideal sample size
      */
-    static size_t GetSampleSize(const std::vector<FileInfo> &input_files) {
+    static size_t GetSampleSize(const std::vector<FileInfo> &input_files, size_t record_size = sizeof(T)) {
         // FIXME: considerations for sample size
         //   (1) samples should ideally fit in L1 cache for maximal binary search efficiency
         //   (2) each bucket should be small enough to fit in main memory; ideally they should be small each that we
@@ -88,10 +94,12 @@ private:
         for (const auto &f: input_files) {
             file_size += f.true_size;
         }
+        // buckets may hold records that are larger than the input elements (e.g. when indices are attached)
+        file_size = file_size / sizeof(T) * record_size;
         // FIXME: assuming no bucket is skewed to the point where it is 3 times the average size
         size_t min_sample_size = std::max(1UL, 4 * parlay::num_workers() * file_size / MAIN_MEMORY_SIZE);
         // max sample size cannot exceed the number of elements; it should also not result in very tiny files
-        size_t max_sample_size = std::max(1UL, std::min(file_size / sizeof(T), file_size / O_DIRECT_MULTIPLE));
+        size_t max_sample_size = std::max(1UL, std::min(file_size / record_size, file_size / O_DIRECT_MULTIPLE));
         // FIXME: need more stuff here; ~128MB per bucket is temporary
         return std::max(std::min(file_size / (1UL << 27), max_sample_size), min_sample_size);
     }
@@ -161,6 +169,117 @@ private:
         }
     };
 
+    typedef IndexedElement<T> Indexed;
+
+    /**
+     * Sort records with attached indices by value. Ties are broken by the original index, so equal elements within
+     * a bucket keep their input order.
+     */
+    template<typename Comparator>
+    static void SortIndexed(Indexed *ptr, size_t n, const Comparator comp) {
+        auto seq = parlay::make_slice(ptr, ptr + n);
+        parlay::sort_inplace(seq, [&](const Indexed &a, const Indexed &b) {
+            if (comp(a.value, b.value)) {
+                return true;
+            }
+            if (comp(b.value, a.value)) {
+                return false;
+            }
+            return a.index < b.index;
+        });
+    }
+
+    /**
+     * Sample pivots from the input and run scatter gather with them.
+     *
+     * @tparam Record Type stored in the buckets (either T or Indexed)
+     * @tparam Output Type written to the result files
+     * @tparam Processor Either a ProcessorFunction or a BucketProcessorFunction of the ScatterGather
+     */
+    template<typename Record, typename Output, typename Comparator, typename Processor>
+    static std::vector<FileInfo> RunSampleSort(std::vector<FileInfo> &input_files,
+                                               const std::string &result_prefix,
+                                               const Comparator comp,
+                                               const Processor &processor) {
+        GetFileInfo(input_files);
+        size_t num_samples = GetSampleSize(input_files, sizeof(Record));
+        const auto pivots = parlay::sort(GetPivots(input_files, num_samples), comp);
+        ScatterGather<T, Record, Output> scatter_gather;
+        DeduplicatingAssigner assigner(pivots, comp);
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_samples + 1;
+        return scatter_gather.Run(input_files, result_prefix,
+                                  assigner.GetAssigner(),
+                                  processor,
+                                  config);
+    }
+
+    /**
+     * Result of one streaming pass of Select
+     */
+    struct SelectPass {
+        // number of elements in each bucket
+        std::vector<size_t> counts;
+        // number of elements in each bucket that are equal to the bucket's lower pivot
+        std::vector<size_t> equal_counts;
+        // elements of the requested buckets (excluding those equal to the lower pivot), indexed by slot
+        std::vector<parlay::sequence<T>> kept;
+    };
+
+    /**
+     * Stream through the input once, count the elements of every bucket and keep the elements of some buckets.
+     *
+     * @param slots Slot in which to keep the elements of each bucket, or -1 if the bucket should only be counted
+     */
+    template<typename Comparator>
+    static SelectPass CountAndCollect(const std::vector<FileInfo> &input_files,
+                                      const parlay::sequence<T> &pivots,
+                                      const Comparator comp,
+                                      const std::vector<size_t> &slots,
+                                      size_t num_slots) {
+        const size_t num_buckets = pivots.size() + 1;
+        UnorderedFileReader<T> reader;
+        reader.PrepFiles(input_files);
+        // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
+        reader.Start(UnorderedReaderConfig(10, 4, 8));
+        auto local_results = parlay::tabulate(parlay::num_workers(), [&](size_t worker_index) {
+            SelectPass local{std::vector<size_t>(num_buckets, 0), std::vector<size_t>(num_buckets, 0),
+                             std::vector<parlay::sequence<T>>(num_slots)};
+            while (true) {
+                auto [ptr, n, _, _2] = reader.Poll();
+                if (n == 0) {
+                    break;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    size_t bucket = BinarySearch(pivots, ptr[i], comp);
+                    local.counts[bucket]++;
+                    // these are resolved from the counts alone, which keeps buckets of duplicates out of memory
+                    if (bucket > 0 && !comp(pivots[bucket - 1], ptr[i])) {
+                        local.equal_counts[bucket]++;
+                    } else if (slots[bucket] != (size_t) -1) {
+                        local.kept[slots[bucket]].push_back(ptr[i]);
+                    }
+                }
+                reader.allocator.Free(ptr);
+            }
+            return local;
+        }, 1);
+        SelectPass result{std::vector<size_t>(num_buckets, 0), std::vector<size_t>(num_buckets, 0),
+                          std::vector<parlay::sequence<T>>(num_slots)};
+        parlay::parallel_for(0, num_buckets, [&](size_t bucket) {
+            for (const auto &local: local_results) {
+                result.counts[bucket] += local.counts[bucket];
+                result.equal_counts[bucket] += local.equal_counts[bucket];
+            }
+        });
+        parlay::parallel_for(0, num_slots, [&](size_t slot) {
+            result.kept[slot] = parlay::flatten(parlay::map(local_results, [&](const SelectPass &local) {
+                return local.kept[slot];
+            }));
+        }, 1);
+        return result;
+    }
+
 public:
 
     template<typename Comparator>
@@ -168,25 +287,263 @@ public:
                                const std::string &result_prefix,
                                const Comparator comp) {
         parlay::internal::timer timer("Sample sort internal", true);
-        GetFileInfo(input_files);
-        size_t num_samples = GetSampleSize(input_files);
-        const auto pivots = parlay::sort(GetPivots(input_files, num_samples), comp);
-        ScatterGather<T> scatter_gather;
-        DeduplicatingAssigner assigner(pivots, comp);
         const auto simple_processor = [&](T **buffer, size_t n) {
             T *ptr = *buffer;
             auto seq = parlay::make_slice(ptr, ptr + n);
             parlay::sort_inplace(seq, comp);
         };
-        ScatterGatherConfig config;
-        config.bucketed_writer_config.num_buckets = num_samples + 1;
-        auto results = scatter_gather.Run(input_files, result_prefix,
-                                          assigner.GetAssigner(),
-                                          simple_processor,
-                                          config);
+        auto results = RunSampleSort<T, T>(input_files, result_prefix, comp, simple_processor);
+        timer.next("Sorting complete");
+        timer.stop();
+        return results;
+    }
+
+    /**
+     * Sort the input and fill a sparse index over the result, taking the first element of every block while each
+     * bucket is still in memory
+     */
+    template<typename Comparator>
+    std::vector<FileInfo> Sort(std::vector<FileInfo> &input_files,
+                               const std::string &result_prefix,
+                               const Comparator comp,
+                               SparseIndex<T, Comparator> &index) {
+        parlay::internal::timer timer("Sample sort with sparse index internal", true);
+        const auto indexing_processor = [&](size_t bucket, T **buffer, size_t n) {
+            T *ptr = *buffer;
+            auto seq = parlay::make_slice(ptr, ptr + n);
+            parlay::sort_inplace(seq, comp);
+            index.AddFile(bucket, ptr, n);
+        };
+        auto results = RunSampleSort<T, T>(input_files, result_prefix, comp, indexing_processor);
+        index.Finish(results);
         timer.next("Sorting complete");
         timer.stop();
-        return {results.begin(), results.end()};
+        return results;
+    }
+
+    /**
+     * Sort the input and keep the position (across all input files) of every element.
+     *
+     * Equal elements may be split across buckets, so their relative order is only guaranteed to follow the input
+     * order within a single result file.
+     *
+     * @return Result files containing <code>IndexedElement&lt;T&gt;</code> in sorted order
+     */
+    template<typename Comparator>
+    std::vector<FileInfo> SortWithIndex(std::vector<FileInfo> &input_files,
+                                        const std::string &result_prefix,
+                                        const Comparator comp) {
+        parlay::internal::timer timer("Sample sort with index internal", true);
+        auto results = RunSampleSort<Indexed, Indexed>(input_files, result_prefix, comp,
+                                                       [&](Indexed **buffer, size_t n) {
+                                                           SortIndexed(*buffer, n, comp);
+                                                       });
+        timer.next("Sorting complete");
+        timer.stop();
+        return results;
+    }
+
+    /**
+     * Compute the permutation that sorts the input: the i-th element of the result is the original position of
+     * the i-th smallest element. Only the positions are written to disk.
+     *
+     * @return Result files containing size_t indices
+     */
+    template<typename Comparator>
+    std::vector<FileInfo> ArgSort(std::vector<FileInfo> &input_files,
+                                  const std::string &result_prefix,
+                                  const Comparator comp) {
+        parlay::internal::timer timer("Argsort internal", true);
+        auto results = RunSampleSort<Indexed, size_t>(input_files, result_prefix, comp,
+                                                      [&](Indexed **buffer, size_t n) {
+            Indexed *ptr = *buffer;
+            SortIndexed(ptr, n, comp);
+            // Compact the indices to the front of the buffer. Going from left to right never overwrites a record
+            // that has not been read yet since an index is no larger than a record.
+            auto *indices = (size_t *) ptr;
+            for (size_t i = 0; i < n; i++) {
+                indices[i] = ptr[i].index;
+            }
+        });
+        timer.next("Argsort complete");
+        timer.stop();
+        return results;
+    }
+
+    /**
+     * Compute the rank of every element: the i-th element of the result is the position of the i-th input element
+     * in sorted order. Ties receive distinct ranks.
+     *
+     * This runs ArgSort and then scatters each rank back to its original position with another round of
+     * scatter gather, where bucket b holds the ranks for a contiguous range of original positions.
+     *
+     * @return Result files containing one size_t rank per input element, in input order (none for an empty input)
+     */
+    template<typename Comparator>
+    std::vector<FileInfo> Rank(std::vector<FileInfo> &input_files,
+                               const std::string &result_prefix,
+                               const Comparator comp) {
+        GetFileInfo(input_files);
+        size_t n = 0;
+        for (const auto &f: input_files) {
+            n += f.true_size / sizeof(T);
+        }
+        if (n == 0) {
+            return {};
+        }
+        parlay::internal::timer timer("Rank internal", true);
+        auto order = ArgSort(input_files, "argsort_" + result_prefix, comp);
+        timer.next("Argsort complete");
+        // the global index of each argsort entry is its rank
+        ComputeBeforeSize(order);
+        // Every range of positions is a multiple of the disk alignment
+        size_t num_buckets = GetSampleSize(input_files, sizeof(IndexedElement<size_t>)) + 1;
+        size_t range_size = AlignUp((n + num_buckets - 1) / num_buckets * sizeof(size_t)) / sizeof(size_t);
+        num_buckets = (n + range_size - 1) / range_size;
+
+        using RankRecord = IndexedElement<size_t>;
+        ScatterGather<size_t, RankRecord, size_t> scatter_gather;
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_buckets;
+        auto results = scatter_gather.Run(
+                order, result_prefix,
+                [=](const size_t &position, [[maybe_unused]] size_t rank) {
+                    return position / range_size;
+                },
+                [=](RankRecord **buffer, size_t count) {
+                    if (count == 0) {
+                        return;
+                    }
+                    // value is the original position and index is the rank
+                    RankRecord *ptr = *buffer;
+                    size_t start = ptr[0].value / range_size * range_size;
+                    auto ranks = parlay::sequence<size_t>::uninitialized(count);
+                    parlay::parallel_for(0, count, [&](size_t i) {
+                        ranks[ptr[i].value - start] = ptr[i].index;
+                    });
+                    memcpy(ptr, ranks.data(), count * sizeof(size_t));
+                },
+                config);
+        timer.next("Ranks scattered");
+        timer.stop();
+        return results;
+    }
+    /**
+     * Find the elements at the given ranks (0-indexed, in sorted order) without sorting the input.
+     *
+     * Pivots from GetPivots split the input into buckets. A streaming pass counts the elements of every bucket,
+     * which determines the bucket holding each rank. The same pass keeps the buckets that the sample predicts to
+     * hold the ranks, so a second pass (over only the buckets that were missed) is rarely needed. Kept buckets are
+     * finished in memory.
+     *
+     * @param ranks Ranks to select; each must be smaller than the number of elements
+     * @return The element at each rank, in the same order as <code>ranks</code>
+     */
+    template<typename Comparator>
+    std::vector<T> Select(std::vector<FileInfo> &input_files,
+                          const std::vector<size_t> &ranks,
+                          const Comparator comp) {
+        parlay::internal::timer timer("Select internal", true);
+        GetFileInfo(input_files);
+        size_t n = 0;
+        for (const auto &f: input_files) {
+            n += f.true_size / sizeof(T);
+        }
+        for (size_t rank: ranks) {
+            CHECK(rank < n) << "Rank " << rank << " is out of range for " << n << " elements";
+        }
+        // elements kept in memory at the same time
+        const size_t memory_budget = MAIN_MEMORY_SIZE / 4 / sizeof(T);
+        // small inputs are kept in a single bucket
+        parlay::sequence<T> pivots;
+        if (n > memory_budget) {
+            // more pivots than sorting would use, since only a handful of buckets have to fit in memory
+            size_t num_pivots = std::min(std::max(GetSampleSize(input_files), 1023UL), n / 64);
+            pivots = parlay::sort(GetPivots(input_files, num_pivots), comp);
+        }
+        const size_t num_buckets = pivots.size() + 1;
+        timer.next("Sampling complete");
+
+        // Pivot i is expected to have rank (i + 1) * n / num_buckets. The error of that estimate is a few buckets
+        // (~num_buckets^(1/4) with the oversampling in GetPivots), so keep a window around the expected bucket.
+        std::vector<size_t> slots(num_buckets, -1);
+        size_t window = pivots.empty() ? 0 : 1 + (size_t) std::ceil(std::pow((double) num_buckets, 0.25));
+        std::vector<size_t> predicted;
+        while (true) {
+            std::set<size_t> buckets;
+            for (size_t rank: ranks) {
+                auto expected = (size_t) ((double) rank / (double) n * (double) num_buckets);
+                size_t first = expected - std::min(expected, window);
+                size_t last = std::min(num_buckets - 1, expected + window);
+                for (size_t b = first; b <= last; b++) {
+                    buckets.insert(b);
+                }
+            }
+            if (buckets.size() * (n / num_buckets) <= memory_budget) {
+                predicted.assign(buckets.begin(), buckets.end());
+                break;
+            }
+            if (window == 0) {
+                // too many ranks to speculate on; find the buckets first
+                break;
+            }
+            window--;
+        }
+        for (size_t i = 0; i < predicted.size(); i++) {
+            slots[predicted[i]] = i;
+        }
+        auto pass = CountAndCollect(input_files, pivots, comp, slots, predicted.size());
+        timer.next("Counting pass complete");
+
+        auto before = pass.counts;
+        parlay::scan_inplace(before);
+        std::vector<T> result(ranks.size());
+        // for every bucket that still needs to be read, the indices of the ranks in it
+        std::map<size_t, std::vector<size_t>> missing;
+        // bucket -> ranks that can be answered with the kept elements
+        std::map<size_t, std::vector<size_t>> resolved;
+        for (size_t i = 0; i < ranks.size(); i++) {
+            size_t bucket = std::upper_bound(before.begin(), before.end(), ranks[i]) - before.begin() - 1;
+            if (ranks[i] - before[bucket] < pass.equal_counts[bucket]) {
+                result[i] = pivots[bucket - 1];
+            } else if (slots[bucket] != (size_t) -1) {
+                resolved[bucket].push_back(i);
+            } else {
+                missing[bucket].push_back(i);
+            }
+        }
+        const auto finish = [&](const std::map<size_t, std::vector<size_t>> &buckets, SelectPass &source) {
+            for (const auto &[bucket, rank_indices]: buckets) {
+                auto &elements = source.kept[slots[bucket]];
+                parlay::sort_inplace(elements, comp);
+                for (size_t i: rank_indices) {
+                    result[i] = elements[ranks[i] - before[bucket] - pass.equal_counts[bucket]];
+                }
+            }
+        };
+        finish(resolved, pass);
+        // read the buckets that were mispredicted, as many at a time as memory allows
+        while (!missing.empty()) {
+            std::fill(slots.begin(), slots.end(), -1);
+            std::map<size_t, std::vector<size_t>> batch;
+            size_t batch_size = 0;
+            for (auto it = missing.begin(); it != missing.end();) {
+                size_t size = pass.counts[it->first] - pass.equal_counts[it->first];
+                if (!batch.empty() && batch_size + size > memory_budget) {
+                    break;
+                }
+                batch_size += size;
+                slots[it->first] = batch.size();
+                batch.insert(*it);
+                it = missing.erase(it);
+            }
+            LOG(INFO) << "Reading " << batch.size() << " mispredicted buckets";
+            auto extra_pass = CountAndCollect(input_files, pivots, comp, slots, batch.size());
+            finish(batch, extra_pass);
+            timer.next("Extra pass complete");
+        }
+        timer.stop();
+        return result;
     }
 };
 
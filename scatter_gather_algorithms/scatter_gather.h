@@ -9,6 +9,7 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <type_traits>
 
 #include "parlay/primitives.h"
 #include "parlay/internal/get_time.h"
@@ -29,20 +30,74 @@ struct BucketedWriterConfig {
 struct ScatterGatherConfig {
     UnorderedReaderConfig reader_config;
     BucketedWriterConfig bucketed_writer_config;
+    // Prefix of the bucket files; algorithms that keep the buckets of several inputs at once need distinct prefixes
+    std::string intermediate_prefix = "spfx_";
     // Prints detailed performance statistics
     bool benchmark_mode = false;
 };
 
+/**
+ * An element tagged with its position in the input sequence (i.e. the global index computed from before_size)
+ */
+template<typename T>
+struct IndexedElement {
+    T value;
+    size_t index;
+};
+
+/**
+ * Map a hash to one of num_buckets buckets. The hash goes through a finalizer first so that the elements of a bucket
+ * do not share the low bits that in-memory hash tables rely on.
+ */
+inline size_t HashToBucket(uint64_t hash, size_t num_buckets) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    return (size_t) (((unsigned __int128) hash * num_buckets) >> 64);
+}
+
 /**
  * Perform external memory sample sort
  *
- * @tparam T The type to be sorted
+ * @tparam T The type to be read from the input files
+ * @tparam Record The type stored in the buckets. If it differs from T, each element is stored together with its
+ * global index as <code>Record{element, index}</code> (see IndexedElement).
+ * @tparam Output The type written to the result files. If it differs from Record, the processor must compact
+ * the n results of type Output to the front of the buffer; sizeof(Output) must not exceed sizeof(Record).
  */
-template<typename T>
+template<typename T, typename Record = T, typename Output = Record>
 class ScatterGather {
+    static_assert(sizeof(Output) <= sizeof(Record), "Output must fit in the buffer of the bucket");
 public:
     typedef std::function<size_t(const T &, size_t)> AssignerFunction;
-    typedef std::function<void(T **, size_t)> ProcessorFunction;
+    typedef std::function<void(Record **, size_t)> ProcessorFunction;
+    /**
+     * A processor that is also given the index of the bucket, which is the index of its result file.
+     * Called with (bucket index, buffer, number of records).
+     */
+    typedef std::function<void(size_t, Record **, size_t)> BucketProcessorFunction;
+    /**
+     * Optionally replaces the global index of every element in a chunk before it is assigned and stored.
+     * Called with (global index of the first element, number of elements, output array of that length).
+     */
+    typedef std::function<void(size_t, size_t, size_t *)> IndexFunction;
+    /**
+     * Assigns a whole chunk at once, avoiding a function call per element.
+     * Called with (chunk, number of elements, global index of the first element, output array of bucket indices).
+     */
+    typedef std::function<void(const T *, size_t, size_t, size_t *)> BlockAssignerFunction;
+    /**
+     * Absorbs elements before they are assigned to buckets, e.g. to pre-aggregate them (a combiner).
+     * Called with (chunk, number of elements, flush). It writes the elements that should be assigned right away to the
+     * front of the chunk and returns their count, which may not exceed the number of elements passed in. Once the
+     * input is exhausted, it is called repeatedly with an empty buffer of READER_READ_SIZE bytes and flush set until
+     * it returns 0.
+     */
+    typedef std::function<size_t(T *, size_t, bool)> CombinerFunction;
+    /**
+     * Creates the combiner of a phase 1 worker, so that every worker owns its state
+     */
+    typedef std::function<CombinerFunction()> CombinerFactory;
 
 private:
 
@@ -60,36 +115,74 @@ private:
      * @param flush_threshold The number of bytes in each bucket. This is the threshold at which a bucket gets sent
      * to the writer. It may or may not be written to disk at the writer's discretion.
      * @param comp
+     * @param block_assigner If set, it is used instead of assigner
+     * @param index_function If set, the indices it produces are used in place of the global index of each element
+     * @param combiner_factory If set, each chunk passes through this worker's combiner before it is assigned
      */
-    void AssignToBucket(size_t num_buckets, const AssignerFunction assigner, const std::vector<FileInfo> &files) {
+    void AssignToBucket(size_t num_buckets, const AssignerFunction &assigner,
+                        const BlockAssignerFunction &block_assigner, const std::vector<FileInfo> &files,
+                        const IndexFunction &index_function, const CombinerFactory &combiner_factory) {
         // reads from the reader and put result into a thread-local buffer; send to intermediate_writer when buffer is full
-        size_t buffer_size = SAMPLE_SORT_BUCKET_SIZE / sizeof(T);
+        size_t buffer_size = SAMPLE_SORT_BUCKET_SIZE / sizeof(Record);
         // each bucket stores a pointer to an array, which will hold temporary values in that bucket
-        T *buckets[num_buckets];
+        Record *buckets[num_buckets];
         unsigned int buffer_index[num_buckets];
         for (size_t i = 0; i < num_buckets; i++) {
-            buckets[i] = (T *) bucket_allocator::alloc();
+            buckets[i] = (Record *) bucket_allocator::alloc();
             buffer_index[i] = 0;
         }
+        std::vector<size_t> indices, bucket_indices;
+        CombinerFunction combiner;
+        if (combiner_factory) {
+            combiner = combiner_factory();
+        }
+        // the combiner's output after the input is exhausted
+        T *flush_buffer = nullptr;
         while (true) {
             auto [data, size, file_index, data_index] = reader.Poll();
-            if (data == nullptr) {
+            if (combiner) {
+                if (data != nullptr) {
+                    size = combiner(data, size, false);
+                } else {
+                    if (flush_buffer == nullptr) {
+                        flush_buffer = reader.allocator.Alloc();
+                    }
+                    data = flush_buffer;
+                    size = combiner(data, 0, true);
+                    if (size == 0) {
+                        reader.allocator.Free(flush_buffer);
+                        break;
+                    }
+                }
+            } else if (data == nullptr) {
                 break;
             }
-            const size_t index_start = files[file_index].before_size + data_index;
+            // before_size is in bytes while data_index counts elements; combined elements no longer have a position
+            const size_t index_start =
+                    data == flush_buffer ? 0 : files[file_index].before_size / sizeof(T) + data_index;
+            if (index_function) {
+                indices.resize(size);
+                index_function(index_start, size, indices.data());
+            }
+            if (block_assigner) {
+                bucket_indices.resize(size);
+                block_assigner(data, size, index_start, bucket_indices.data());
+            }
             for (size_t i = 0; i < size; i++) {
-                // use binary search to find which bucket it belongs to
-                size_t bucket_index = assigner(data[i], index_start + i);
+                size_t index = index_function ? indices[i] : index_start + i;
+                size_t bucket_index = block_assigner ? bucket_indices[i] : assigner(data[i], index);
                 // move data to bucket
-                buckets[bucket_index][buffer_index[bucket_index]++] = data[i];
+                buckets[bucket_index][buffer_index[bucket_index]++] = MakeRecord(data[i], index);
                 // flush if bucket is full
                 if (buffer_index[bucket_index] == buffer_size) {
                     buffer_index[bucket_index] = 0;
                     intermediate_writer.Write(bucket_index, buckets[bucket_index], buffer_size);
-                    buckets[bucket_index] = (T *) bucket_allocator::alloc();
+                    buckets[bucket_index] = (Record *) bucket_allocator::alloc();
                 }
             }
-            reader.allocator.Free(data);
+            if (data != flush_buffer) {
+                reader.allocator.Free(data);
+            }
         }
         // cleanup partially full buckets
         for (size_t i = 0; i < num_buckets; i++) {
@@ -110,34 +203,71 @@ private:
      * @param comparator
      * @return Information of the resulting file
      */
-    FileInfo ProcessBucket(const FileInfo &file_info, const std::string &target_file,
-                           const ProcessorFunction processor) {
+    FileInfo ProcessBucket(const FileInfo &file_info, size_t index, const std::string &target_file,
+                           const BucketProcessorFunction processor) {
         // use parlay's sorting utility to sort this bucket
-        T *buffer = (T *) ReadEntireFile(file_info.file_name, file_info.file_size);
-        size_t n = file_info.true_size / sizeof(T);
-        processor(&buffer, n);
+        Record *buffer = (Record *) ReadEntireFile(file_info.file_name, file_info.file_size);
+        size_t n = file_info.true_size / sizeof(Record);
+        processor(index, &buffer, n);
+        FileInfo result(target_file, file_info);
+        ResizeOutput(buffer, n, result);
         int fd = open(target_file.c_str(), O_WRONLY | O_DIRECT | O_CREAT, 0644);
         SYSCALL(fd);
-        SYSCALL(write(fd, buffer, file_info.file_size));
+        SYSCALL(write(fd, buffer, result.file_size));
         close(fd);
         // FIXME: this is very expensive because munmap is called every time
         free(buffer);
-        return {target_file, file_info};
+        return result;
+    }
+
+    static BucketProcessorFunction IgnoreBucket(const ProcessorFunction &processor) {
+        return [processor](size_t, Record **buffer, size_t n) {
+            processor(buffer, n);
+        };
+    }
+
+    static inline Record MakeRecord(const T &t, [[maybe_unused]] size_t index) {
+        if constexpr (std::is_same_v<T, Record>) {
+            return t;
+        } else {
+            return Record{t, index};
+        }
+    }
+
+    /**
+     * Fix the size of a processed bucket whose output type differs from its record type.
+     * The processor has already compacted n Output elements to the front of the buffer, so the end marker
+     * needs to be rewritten for the smaller file. Buckets with <code>Output == Record</code> are left untouched
+     * since they still end with the marker written by the OrderedFileWriter.
+     */
+    static void ResizeOutput(Record *buffer, size_t n, FileInfo &info) {
+        if constexpr (!std::is_same_v<Record, Output>) {
+            size_t true_size = n * sizeof(Output);
+            // Same layout as OrderedFileWriter: always end with a partial block that has room for the marker
+            size_t file_size = (true_size / O_DIRECT_MULTIPLE + 1) * O_DIRECT_MULTIPLE;
+            if (file_size - true_size < METADATA_SIZE) {
+                file_size += O_DIRECT_MULTIPLE;
+            }
+            CHECK(file_size <= info.file_size);
+            MakeFileEndMarker((unsigned char *) buffer, file_size, true_size);
+            info.true_size = true_size;
+            info.file_size = file_size;
+        }
     }
 
     // reader for the input files
     UnorderedFileReader<T> reader;
     // writer to handle all the buckets created in phase 1 of sample sort
-    OrderedFileWriter<T, SAMPLE_SORT_BUCKET_SIZE> intermediate_writer;
+    OrderedFileWriter<Record, SAMPLE_SORT_BUCKET_SIZE> intermediate_writer;
 
     parlay::sequence<FileInfo>
-    QueuePhase2(const std::string &result_prefix, const ProcessorFunction &processor,
+    QueuePhase2(const std::string &result_prefix, const BucketProcessorFunction &processor,
                 const std::vector<FileInfo> &bucket_list) {
         parlay::internal::timer timer("phase 2 internal");
         const size_t num_files = bucket_list.size();
         parlay::sequence<FileInfo> results(num_files, FileInfo("", 0, 0, 0));
         std::atomic<size_t> current_file = 0, files_read = 0;
-        SimpleQueue<std::pair<size_t, T *>> read_queue, write_queue;
+        SimpleQueue<std::pair<size_t, Record *>> read_queue, write_queue;
         std::vector<std::thread> read_workers, write_workers;
         read_queue.SetSizeLimit(256);
         write_queue.SetSizeLimit(256);
@@ -149,7 +279,7 @@ private:
                         return;
                     }
                     const FileInfo &file = bucket_list[index];
-                    auto pointer = (T *) ReadEntireFile(file.file_name, file.file_size);
+                    auto pointer = (Record *) ReadEntireFile(file.file_name, file.file_size);
                     read_queue.Push({index, pointer});
                     index = ++files_read;
                     if (index == num_files) {
@@ -164,14 +294,15 @@ private:
                         return;
                     }
                     auto [index, pointer] = res;
-                    FileInfo file = bucket_list[index];
                     auto file_name = GetFileName(result_prefix, index);
+                    FileInfo file(file_name, bucket_list[index]);
+                    ResizeOutput(pointer, bucket_list[index].true_size / sizeof(Record), file);
                     int fd = open(file_name.c_str(), O_WRONLY | O_DIRECT | O_CREAT, 0644);
                     SYSCALL(fd);
                     SYSCALL(write(fd, pointer, file.file_size));
                     close(fd);
                     free(pointer);
-                    results[index] = {file_name, bucket_list[index]};
+                    results[index] = file;
                 }
             });
         }
@@ -183,8 +314,8 @@ private:
                     return;
                 }
                 auto [index, pointer] = res;
-                size_t n = bucket_list[index].true_size / sizeof(T);
-                processor(&pointer, n);
+                size_t n = bucket_list[index].true_size / sizeof(Record);
+                processor(index, &pointer, n);
                 write_queue.Push(std::pair(index, pointer));
             }
         }, 1);
@@ -202,11 +333,11 @@ private:
     }
 
     parlay::sequence<FileInfo>
-    WorkerOnlyPhase2(const std::string &result_prefix, const ProcessorFunction &processor,
+    WorkerOnlyPhase2(const std::string &result_prefix, const BucketProcessorFunction &processor,
                      const std::vector<FileInfo> &bucket_list) {
         struct LocalFile {
             int fd;
-            T *buffer;
+            Record *buffer;
             FileInfo info;
         };
         std::atomic<size_t> current_file = 0;
@@ -247,7 +378,7 @@ private:
                     const auto &file_info = bucket_list[index];
                     next.fd = open(file_info.file_name.c_str(), O_RDONLY | O_DIRECT);
                     SYSCALL(next.fd);
-                    next.buffer = (T *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, file_info.file_size);
+                    next.buffer = (Record *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, file_info.file_size);
                     next.info = file_info;
                     next.info.file_index = index;
                     auto sqe = io_uring_get_sqe(&read_ring);
@@ -260,7 +391,9 @@ private:
 
                 // process
                 if (need_process) {
-                    processor(&current.buffer, current.info.true_size / sizeof(T));
+                    size_t n = current.info.true_size / sizeof(Record);
+                    processor(current.info.file_index, &current.buffer, n);
+                    ResizeOutput(current.buffer, n, current.info);
                     current.info.file_name = GetFileName(result_prefix, current.info.file_index);
                     int fd = open(current.info.file_name.c_str(),
                                   O_DIRECT | O_WRONLY | O_CREAT,
@@ -298,29 +431,28 @@ private:
     }
 
     parlay::sequence<FileInfo>
-    SimplePhase2(const std::string &result_prefix, const ProcessorFunction &processor,
+    SimplePhase2(const std::string &result_prefix, const BucketProcessorFunction &processor,
                  const std::vector<FileInfo> &bucket_list) {
         return parlay::tabulate(bucket_list.size(), [&](size_t i) {
             const auto &file_info = bucket_list[i];
             auto result_name = GetFileName(result_prefix, i);
-            ProcessBucket(file_info, result_name, processor);
-            return FileInfo(result_name, file_info);
+            return ProcessBucket(file_info, i, result_name, processor);
         }, 1);
     }
 
-public:
-
-    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files,
-                              const std::string &result_prefix,
-                              const AssignerFunction assigner,
-                              const ProcessorFunction processor,
-                              const ScatterGatherConfig &config) {
-        parlay::internal::timer timer("Scatter gather internal", true);
+    std::vector<FileInfo> ScatterImpl(std::vector<FileInfo> &input_files,
+                                      const AssignerFunction &assigner,
+                                      const BlockAssignerFunction &block_assigner,
+                                      const ScatterGatherConfig &config,
+                                      const IndexFunction &index_function,
+                                      const CombinerFactory &combiner_factory = nullptr) {
+        CHECK(!combiner_factory || (std::is_same_v<T, Record> && !index_function))
+            << "Combined elements have no position, so they cannot carry or be assigned by an index";
+        parlay::internal::timer timer("Scatter gather phase 1", true);
         reader.PrepFiles(input_files);
         reader.Start(config.reader_config);
-        // FIXME: change this file name to a different one (possibly randomized?)
         size_t num_buckets = config.bucketed_writer_config.num_buckets;
-        intermediate_writer.Initialize("spfx_", num_buckets, 1 << 20);
+        intermediate_writer.Initialize(config.intermediate_prefix, num_buckets, 1 << 20);
         timer.next("Start phase 1 (assign to buckets)");
         std::vector<FileInfo> bucket_list;
         auto intermedia_io_threads = config.bucketed_writer_config.num_threads;
@@ -331,7 +463,7 @@ public:
             }, 1);
         }, [&]() {
             parlay::parallel_for(0, parlay::num_workers() - intermedia_io_threads, [&](int i) {
-                AssignToBucket(num_buckets, assigner, input_files);
+                AssignToBucket(num_buckets, assigner, block_assigner, input_files, index_function, combiner_factory);
             }, 1);
             // retrieve buckets from intermediate_writer
             bucket_list = intermediate_writer.ReapResult();
@@ -344,16 +476,105 @@ public:
         } else {
             timer.next("After assign to bucket and before phase 2");
         }
+        timer.stop();
+        return bucket_list;
+    }
+
+public:
+
+    /**
+     * Phase 1 only: distribute the input into buckets according to the assigner.
+     *
+     * @param index_function Optional replacement for the global index passed to the assigner and stored in records
+     * @return One file per bucket, in bucket order. Each file ends with an OrderedFileWriter marker.
+     */
+    std::vector<FileInfo> Scatter(std::vector<FileInfo> &input_files,
+                                  const AssignerFunction assigner,
+                                  const ScatterGatherConfig &config,
+                                  const IndexFunction index_function = nullptr) {
+        return ScatterImpl(input_files, assigner, nullptr, config, index_function);
+    }
+
+    std::vector<FileInfo> Scatter(std::vector<FileInfo> &input_files,
+                                  const BlockAssignerFunction block_assigner,
+                                  const ScatterGatherConfig &config,
+                                  const IndexFunction index_function = nullptr) {
+        return ScatterImpl(input_files, nullptr, block_assigner, config, index_function);
+    }
+
+    /**
+     * Phase 1 with a combiner: every worker passes its chunks through its own combiner before they are assigned, so
+     * only the elements it emits reach the buckets. Only for buckets of plain elements (Record == T).
+     */
+    std::vector<FileInfo> Scatter(std::vector<FileInfo> &input_files,
+                                  const BlockAssignerFunction block_assigner,
+                                  const CombinerFactory combiner_factory,
+                                  const ScatterGatherConfig &config) {
+        return ScatterImpl(input_files, nullptr, block_assigner, config, nullptr, combiner_factory);
+    }
+
+    /**
+     * Phase 2 only: process the buckets produced by Scatter. Result file i is bucket_list[i] after processing, so
+     * passing a prefix of the buckets skips the rest without reading them.
+     *
+     * @param input_files The input of phase 1; only used to report throughput
+     */
+    std::vector<FileInfo> Gather(const std::vector<FileInfo> &input_files,
+                                 const std::string &result_prefix,
+                                 const std::vector<FileInfo> &bucket_list,
+                                 const BucketProcessorFunction &processor,
+                                 const ScatterGatherConfig &config) {
+        parlay::internal::timer timer("Scatter gather phase 2", true);
         parlay::sequence<FileInfo> results = WorkerOnlyPhase2(result_prefix, processor, bucket_list);
         if (config.benchmark_mode) {
             double throughput = GetThroughput(input_files, timer.next_time());
             std::cout << "Throughput2: " << throughput << "GB\n";
         } else {
-            timer.next("After assign to bucket and before phase 2");
+            timer.next("After phase 2");
         }
         timer.stop();
         return {results.begin(), results.end()};
     }
+
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files,
+                              const std::string &result_prefix,
+                              const AssignerFunction assigner,
+                              const ProcessorFunction processor,
+                              const ScatterGatherConfig &config,
+                              const IndexFunction index_function = nullptr) {
+        return Gather(input_files, result_prefix, Scatter(input_files, assigner, config, index_function),
+                      IgnoreBucket(processor), config);
+    }
+
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files,
+                              const std::string &result_prefix,
+                              const BlockAssignerFunction block_assigner,
+                              const ProcessorFunction processor,
+                              const ScatterGatherConfig &config,
+                              const IndexFunction index_function = nullptr) {
+        return Gather(input_files, result_prefix, Scatter(input_files, block_assigner, config, index_function),
+                      IgnoreBucket(processor), config);
+    }
+
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files,
+                              const std::string &result_prefix,
+                              const AssignerFunction assigner,
+                              const BucketProcessorFunction processor,
+                              const ScatterGatherConfig &config,
+                              const IndexFunction index_function = nullptr) {
+        return Gather(input_files, result_prefix, Scatter(input_files, assigner, config, index_function),
+                      processor, config);
+    }
+
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files,
+                              const std::string &result_prefix,
+                              const BlockAssignerFunction block_assigner,
+                              const BucketProcessorFunction processor,
+                              const ScatterGatherConfig &config,
+                              const IndexFunction index_function = nullptr) {
+        return Gather(input_files, result_prefix, Scatter(input_files, block_assigner, config, index_function),
+                      processor, config);
+    }
 };
 
 #endif //SORTING_SCATTER_GATHER_H
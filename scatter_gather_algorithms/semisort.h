@@ -0,0 +1,150 @@
+#ifndef SORTING_SEMISORT_H
+#define SORTING_SEMISORT_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/logger.h"
+#include "utils/random_read.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+
+/**
+ * Group elements with equal keys together without ordering the groups.
+ *
+ * Phase 1 assigns elements to buckets by the hash of their key, so no pivots or comparisons are needed. Keys that are
+ * frequent in a random sample (heavy keys) get dedicated buckets. A heavy bucket holds a single key and is therefore
+ * already grouped, so phase 2 renames its file instead of reading it; a skewed key can take up any amount of space
+ * without having to fit in memory. Phase 2 groups each light bucket in memory by numbering its distinct keys and
+ * placing the elements with a counting sort.
+ *
+ * @tparam T Type of the elements
+ * @tparam Key Type of the keys; must be hashable with absl::Hash
+ */
+template<typename T, typename Key>
+class Semisort {
+public:
+    /**
+     * @param key <code>Key key(const T &)</code>
+     * @return One file per bucket; every key appears in exactly one file, and its elements are contiguous
+     */
+    template<typename KeyFunction>
+    std::vector<FileInfo> Run(std::vector<FileInfo> &input_files, const std::string &result_prefix, KeyFunction key) {
+        parlay::internal::timer timer("Semisort", true);
+        GetFileInfo(input_files);
+        size_t input_size = 0;
+        for (const auto &f: input_files) {
+            input_size += f.true_size;
+        }
+        size_t n = input_size / sizeof(T);
+        // every worker needs to fit a bucket in memory in phase 2
+        size_t num_light_buckets = std::max(1UL, 4 * parlay::num_workers() * input_size / MAIN_MEMORY_SIZE);
+        auto heavy_keys = GetHeavyKeys(input_files, n, num_light_buckets, key);
+        // heavy keys come after the light buckets
+        absl::flat_hash_map<Key, size_t> heavy_buckets;
+        for (size_t i = 0; i < heavy_keys.size(); i++) {
+            heavy_buckets[heavy_keys[i]] = num_light_buckets + i;
+        }
+        LOG(INFO) << "Semisort: " << num_light_buckets << " light buckets and " << heavy_keys.size()
+                  << " heavy keys";
+        timer.next("Heavy keys sampled");
+
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = num_light_buckets + heavy_keys.size();
+        const auto assigner = [&](const T *data, size_t count, size_t index_start, size_t *buckets) {
+            for (size_t i = 0; i < count; i++) {
+                Key k = key(data[i]);
+                auto it = heavy_buckets.find(k);
+                buckets[i] = it == heavy_buckets.end() ? HashToBucket(absl::Hash<Key>()(k), num_light_buckets)
+                                                       : it->second;
+            }
+        };
+        const auto processor = [&](size_t, T **buffer, size_t count) {
+            GroupBucket(*buffer, count, key);
+        };
+        ScatterGather<T> scatter_gather;
+        auto buckets = scatter_gather.Scatter(input_files,
+                                              typename ScatterGather<T>::BlockAssignerFunction(assigner), config);
+        timer.next("Elements scattered");
+        std::vector<FileInfo> light_buckets(buckets.begin(), buckets.begin() + (long) num_light_buckets);
+        auto results = scatter_gather.Gather(input_files, result_prefix, light_buckets, processor, config);
+        // a bucket file lives on the same SSD as the result file with the same index, so renaming it moves no data
+        for (size_t i = num_light_buckets; i < buckets.size(); i++) {
+            FileInfo result(GetFileName(result_prefix, i), buckets[i]);
+            SYSCALL(rename(buckets[i].file_name.c_str(), result.file_name.c_str()));
+            // bucket files are not truncated when they are created, so drop whatever an earlier, larger run left
+            SYSCALL(truncate(result.file_name.c_str(), (off_t) result.file_size));
+            results.push_back(result);
+        }
+        ComputeBeforeSize(results);
+        timer.next("Semisort complete");
+        timer.stop();
+        return results;
+    }
+
+private:
+    /**
+     * Find keys that are expected to hold at least half a bucket's worth of elements
+     */
+    template<typename KeyFunction>
+    static std::vector<Key> GetHeavyKeys(const std::vector<FileInfo> &input_files, size_t n,
+                                         size_t num_light_buckets, KeyFunction key) {
+        if (n == 0 || num_light_buckets == 1) {
+            return {};
+        }
+        size_t sample_size = std::min(n, 64 * num_light_buckets);
+        parlay::random_generator generator;
+        std::uniform_int_distribution<size_t> dis(0, n - 1);
+        auto samples = RandomBatchReadCoalesced<T>(input_files, parlay::tabulate(sample_size, [&](size_t i) {
+            auto gen = generator[i];
+            return dis(gen);
+        }));
+        absl::flat_hash_map<Key, size_t> counts;
+        for (const auto &s: samples) {
+            counts[key(s)]++;
+        }
+        std::vector<Key> result;
+        for (const auto &[k, count]: counts) {
+            if (2 * count * num_light_buckets >= sample_size) {
+                result.push_back(k);
+            }
+        }
+        return result;
+    }
+
+    template<typename KeyFunction>
+    static void GroupBucket(T *data, size_t n, KeyFunction key) {
+        absl::flat_hash_map<Key, size_t> ids;
+        auto id = parlay::sequence<uint32_t>::uninitialized(n);
+        for (size_t i = 0; i < n; i++) {
+            id[i] = ids.try_emplace(key(data[i]), ids.size()).first->second;
+        }
+        if (ids.size() <= 1) {
+            // a single key is already grouped
+            return;
+        }
+        parlay::sequence<size_t> offsets(ids.size(), 0);
+        for (size_t i = 0; i < n; i++) {
+            offsets[id[i]]++;
+        }
+        parlay::scan_inplace(offsets);
+        auto grouped = parlay::sequence<T>::uninitialized(n);
+        for (size_t i = 0; i < n; i++) {
+            grouped[offsets[id[i]]++] = data[i];
+        }
+        std::copy(grouped.begin(), grouped.end(), data);
+    }
+};
+
+#endif //SORTING_SEMISORT_H
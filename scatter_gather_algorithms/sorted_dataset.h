@@ -0,0 +1,423 @@
+#ifndef SORTING_SORTED_DATASET_H
+#define SORTING_SORTED_DATASET_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/random_read.h"
+#include "scatter_gather_algorithms/scatter_gather.h"
+#include "scatter_gather_algorithms/sample_sort.h"
+
+/**
+ * Decides when the pending deltas of a key range are merged into its base file
+ */
+struct CompactionPolicy {
+    // a range is merged once it has this many pending runs; 1 merges every delta right away
+    size_t max_runs = 1;
+    // ... or once its pending runs hold at least this fraction of the size of its base file
+    double max_pending_ratio = 0.5;
+};
+
+/**
+ * A sorted dataset that absorbs deltas without being sorted again.
+ *
+ * The dataset is a list of non-empty files in key order; each file covers a key range that starts at its first
+ * element. A delta is sorted by ScatterGather with these first elements as pivots, so it lands in one sorted run per
+ * key range. The part of a skewed delta that falls into one range may not fit in a worker's memory; it is sorted on
+ * its own by SampleSort, with pivots sampled from it, and becomes a run of several files. Runs stay pending next to
+ * their base file (tiering) until the compaction policy merges them. A merge streams the base file and all runs of a
+ * range through a single k-way merge and splits the result into files that fit in memory; only the files of the
+ * merged ranges are rewritten, and every other file stays in place.
+ *
+ * The file list is persisted in a text manifest (prefix.manifest on the first SSD), which is replaced atomically after
+ * every change; files that are no longer referenced are deleted afterwards.
+ *
+ * @tparam T Type of the elements
+ */
+template<typename T, typename Comparator = std::less<T>>
+class SortedDataset {
+public:
+    explicit SortedDataset(const std::string &prefix, Comparator comp = {}, CompactionPolicy policy = {})
+            : prefix(prefix), comp(comp), policy(policy) {}
+
+    /**
+     * Sort the input into a new dataset with SampleSort
+     */
+    void Create(std::vector<FileInfo> &input_files) {
+        auto old_files = AllFiles();
+        ranges.clear();
+        generation++;
+        auto sorted = SampleSort<T>().Sort(input_files, GetGenerationPrefix(), comp);
+        for (auto &f: sorted) {
+            if (f.true_size > 0) {
+                ranges.push_back({f, {}});
+            } else {
+                SYSCALL(unlink(f.file_name.c_str()));
+            }
+        }
+        Commit(old_files);
+    }
+
+    /**
+     * Read the file list from the manifest
+     */
+    void Load() {
+        std::ifstream manifest(GetManifestName());
+        CHECK(manifest.good()) << "Cannot read " << GetManifestName();
+        size_t num_ranges;
+        manifest >> generation >> num_ranges;
+        ranges.resize(num_ranges);
+        for (auto &range: ranges) {
+            size_t num_runs;
+            range.base = ReadFileInfo(manifest);
+            manifest >> num_runs;
+            range.runs.resize(num_runs);
+            for (auto &run: range.runs) {
+                size_t num_files;
+                manifest >> num_files;
+                run.resize(num_files);
+                for (auto &f: run) {
+                    f = ReadFileInfo(manifest);
+                }
+            }
+        }
+        CHECK(!manifest.fail()) << "Malformed manifest " << GetManifestName();
+    }
+
+    /**
+     * Sort a delta into the key ranges of the dataset, then compact the ranges that the policy selects
+     */
+    void Append(std::vector<FileInfo> &delta_files) {
+        parlay::internal::timer timer("Sorted dataset append", true);
+        GetFileInfo(delta_files);
+        if (ranges.empty()) {
+            Create(delta_files);
+            return;
+        }
+        // the first element of every range except the first one
+        auto bases = Files();
+        ComputeBeforeSize(bases);
+        auto pivots = RandomBatchReadCoalesced<T>(bases, parlay::tabulate(bases.size() - 1, [&](size_t i) {
+            return bases[i + 1].before_size / sizeof(T);
+        }));
+        generation++;
+        ScatterGatherConfig config;
+        config.bucketed_writer_config.num_buckets = ranges.size();
+        const auto assigner = [&](const T &t, size_t index) {
+            return (size_t) (std::upper_bound(pivots.begin(), pivots.end(), t, comp) - pivots.begin());
+        };
+        const auto processor = [&](size_t, T **buffer, size_t n) {
+            auto seq = parlay::make_slice(*buffer, *buffer + n);
+            parlay::sort_inplace(seq, comp);
+        };
+        ScatterGather<T> scatter_gather;
+        auto buckets = scatter_gather.Scatter(delta_files,
+                                              typename ScatterGather<T>::AssignerFunction(assigner), config);
+        CHECK(buckets.size() == ranges.size());
+        timer.next("Delta scattered");
+        // buckets that a worker can sort in memory go through phase 2; empty buckets are skipped
+        std::vector<size_t> light, heavy;
+        std::vector<FileInfo> light_buckets;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (buckets[i].true_size / sizeof(T) > MaxFileElements()) {
+                heavy.push_back(i);
+            } else if (buckets[i].true_size > 0) {
+                light.push_back(i);
+                light_buckets.push_back(buckets[i]);
+            }
+        }
+        auto runs = scatter_gather.Gather(delta_files, GetGenerationPrefix(), light_buckets, processor, config);
+        for (size_t j = 0; j < light.size(); j++) {
+            ranges[light[j]].runs.push_back({runs[j]});
+        }
+        timer.next("Light buckets sorted");
+        // SampleSort reuses the intermediate files of ScatterGather, so move every heavy bucket out of the way before
+        // the first one is sorted. A new name with the same index stays on the same SSD.
+        const auto bucket_prefix = [&](size_t i) {
+            return GetGenerationPrefix() + std::to_string(i) + "_";
+        };
+        for (size_t i: heavy) {
+            std::string file_name = GetFileName(bucket_prefix(i) + "bucket_", i);
+            SYSCALL(rename(buckets[i].file_name.c_str(), file_name.c_str()));
+            // the bucket is the only input of its sort, so it is file 0 to the reader
+            buckets[i] = FileInfo(file_name, 0, buckets[i].true_size, buckets[i].file_size);
+        }
+        for (size_t i: heavy) {
+            std::vector<FileInfo> bucket{buckets[i]};
+            std::vector<FileInfo> run;
+            for (auto &f: SampleSort<T>().Sort(bucket, bucket_prefix(i), comp)) {
+                if (f.true_size > 0) {
+                    run.push_back(f);
+                } else {
+                    SYSCALL(unlink(f.file_name.c_str()));
+                }
+            }
+            SYSCALL(unlink(buckets[i].file_name.c_str()));
+            ranges[i].runs.push_back(std::move(run));
+        }
+        LOG(INFO) << "Sorted dataset: delta touches " << light.size() + heavy.size() << " of " << ranges.size()
+                  << " ranges; " << heavy.size() << " of them were too large to sort in memory";
+        timer.next("Delta sorted into runs");
+        Compact(false);
+        timer.next("Ranges compacted");
+        timer.stop();
+    }
+
+    /**
+     * Merge pending runs into their base files
+     *
+     * @param all Merge every range with pending runs instead of only those selected by the policy
+     */
+    void Compact(bool all = true) {
+        auto old_files = AllFiles();
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < ranges.size(); i++) {
+            if (!ranges[i].runs.empty() && (all || ShouldMerge(ranges[i]))) {
+                merged.push_back(i);
+            }
+        }
+        if (merged.empty()) {
+            Commit(old_files);
+            return;
+        }
+        generation++;
+        // a merged range is split into files that a worker can hold in memory
+        auto num_pieces = parlay::map(merged, [&](size_t i) {
+            size_t n = ranges[i].base.true_size / sizeof(T) + RunSize(ranges[i]);
+            return (n + MaxFileElements() - 1) / MaxFileElements();
+        });
+        auto first_piece = parlay::scan(num_pieces).first;
+        std::vector<std::vector<FileInfo>> pieces(merged.size());
+        parlay::parallel_for(0, merged.size(), [&](size_t j) {
+            pieces[j] = MergeRange(ranges[merged[j]], num_pieces[j], first_piece[j]);
+        }, 1);
+        std::vector<Range> new_ranges;
+        for (size_t i = 0, j = 0; i < ranges.size(); i++) {
+            if (j < merged.size() && merged[j] == i) {
+                for (auto &piece: pieces[j]) {
+                    new_ranges.push_back({piece, {}});
+                }
+                j++;
+            } else {
+                new_ranges.push_back(ranges[i]);
+            }
+        }
+        LOG(INFO) << "Sorted dataset: merged " << merged.size() << " ranges; " << new_ranges.size() << " ranges now";
+        ranges = std::move(new_ranges);
+        Commit(old_files);
+    }
+
+    /**
+     * @return Files of the dataset in key order, excluding the runs that are still pending
+     */
+    [[nodiscard]] std::vector<FileInfo> Files() const {
+        std::vector<FileInfo> files;
+        for (const auto &range: ranges) {
+            files.push_back(range.base);
+        }
+        return files;
+    }
+
+    [[nodiscard]] size_t PendingRuns() const {
+        size_t count = 0;
+        for (const auto &range: ranges) {
+            count += range.runs.size();
+        }
+        return count;
+    }
+
+private:
+    struct Range {
+        FileInfo base;
+        // sorted deltas of this key range, oldest first; each run is one or more files in key order
+        std::vector<std::vector<FileInfo>> runs;
+    };
+
+    std::string prefix;
+    Comparator comp;
+    CompactionPolicy policy;
+    std::vector<Range> ranges;
+    // incremented whenever new files are written, so that file names are never reused
+    size_t generation = 0;
+
+    [[nodiscard]] std::string GetManifestName() const {
+        return GetSSDList()[0] + "/" + prefix + ".manifest";
+    }
+
+    [[nodiscard]] std::string GetGenerationPrefix() const {
+        return prefix + "_" + std::to_string(generation) + "_";
+    }
+
+    static FileInfo ReadFileInfo(std::ifstream &manifest) {
+        FileInfo f;
+        manifest >> f.file_name >> f.true_size >> f.file_size;
+        return f;
+    }
+
+    /**
+     * Number of elements in a file of the dataset that a worker can hold in memory, which also bounds the buckets of
+     * a delta that are sorted in memory
+     */
+    static size_t MaxFileElements() {
+        return std::max(1UL, MAIN_MEMORY_SIZE / 4 / parlay::num_workers() / sizeof(T));
+    }
+
+    /**
+     * @return Number of elements in the pending runs of a range
+     */
+    static size_t RunSize(const Range &range) {
+        size_t n = 0;
+        for (const auto &run: range.runs) {
+            for (const auto &f: run) {
+                n += f.true_size / sizeof(T);
+            }
+        }
+        return n;
+    }
+
+    [[nodiscard]] bool ShouldMerge(const Range &range) const {
+        return range.runs.size() >= policy.max_runs
+               || (double) (RunSize(range) * sizeof(T)) >= policy.max_pending_ratio * (double) range.base.true_size;
+    }
+
+    [[nodiscard]] std::vector<std::string> AllFiles() const {
+        std::vector<std::string> files;
+        for (const auto &range: ranges) {
+            files.push_back(range.base.file_name);
+            for (const auto &run: range.runs) {
+                for (const auto &f: run) {
+                    files.push_back(f.file_name);
+                }
+            }
+        }
+        return files;
+    }
+
+    /**
+     * Merge the base file of a range with its runs in a single k-way pass and write the result to consecutive files.
+     *
+     * Every input is streamed through a buffer; the buffers of all inputs together are as large as one output file,
+     * so a worker holds at most two files' worth of elements regardless of the size of the runs.
+     */
+    std::vector<FileInfo> MergeRange(const Range &range, size_t num_pieces, size_t first_piece) {
+        struct Cursor {
+            std::vector<FileInfo> files;
+            std::vector<int> fds;
+            // elements in all files and elements read from them so far
+            size_t size = 0, read = 0;
+            parlay::sequence<T> buffer;
+            size_t position = 0, count = 0;
+        };
+        // the base file is the oldest input
+        std::vector<Cursor> inputs(range.runs.size() + 1);
+        inputs[0].files = {range.base};
+        for (size_t i = 0; i < range.runs.size(); i++) {
+            inputs[i + 1].files = range.runs[i];
+        }
+        const size_t buffer_size = std::max(1UL, MaxFileElements() / inputs.size());
+        const auto refill = [&](Cursor &cursor) {
+            cursor.count = std::min(buffer_size, cursor.size - cursor.read);
+            ReadFileRange(cursor.files, cursor.fds, cursor.read * sizeof(T), cursor.count * sizeof(T),
+                          cursor.buffer.data());
+            cursor.read += cursor.count;
+            cursor.position = 0;
+        };
+        // heap of the next element of every input; older inputs come first among equal elements
+        using Head = std::pair<T, size_t>;
+        std::vector<Head> heap;
+        const auto later = [&](const Head &a, const Head &b) {
+            return comp(b.first, a.first) || (!comp(a.first, b.first) && a.second > b.second);
+        };
+        size_t total = 0;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            auto &cursor = inputs[i];
+            ComputeBeforeSize(cursor.files);
+            cursor.fds = OpenFiles(cursor.files);
+            for (const auto &f: cursor.files) {
+                cursor.size += f.true_size / sizeof(T);
+            }
+            total += cursor.size;
+            cursor.buffer = parlay::sequence<T>::uninitialized(std::min(buffer_size, cursor.size));
+            if (cursor.size > 0) {
+                refill(cursor);
+                heap.emplace_back(cursor.buffer[0], i);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        std::vector<FileInfo> pieces;
+        for (size_t p = 0; p < num_pieces; p++) {
+            size_t start = total * p / num_pieces, end = total * (p + 1) / num_pieces;
+            size_t true_size = (end - start) * sizeof(T);
+            auto buffer = (T *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, AlignUp(true_size + METADATA_SIZE));
+            for (size_t k = 0; k < end - start; k++) {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                auto [value, i] = heap.back();
+                heap.pop_back();
+                buffer[k] = value;
+                auto &cursor = inputs[i];
+                if (++cursor.position == cursor.count && cursor.read < cursor.size) {
+                    refill(cursor);
+                }
+                if (cursor.position < cursor.count) {
+                    heap.emplace_back(cursor.buffer[cursor.position], i);
+                    std::push_heap(heap.begin(), heap.end(), later);
+                }
+            }
+            std::string file_name = GetFileName(GetGenerationPrefix(), first_piece + p);
+            size_t file_size = WriteFileWithEndMarker(file_name, buffer, true_size);
+            free(buffer);
+            pieces.push_back({file_name, first_piece + p, true_size, file_size});
+        }
+        CHECK(heap.empty());
+        for (const auto &cursor: inputs) {
+            CloseFiles(cursor.fds);
+        }
+        return pieces;
+    }
+
+    /**
+     * Replace the manifest, then delete the files that it no longer references
+     */
+    void Commit(const std::vector<std::string> &old_files) {
+        std::string manifest_name = GetManifestName(), temp_name = manifest_name + ".tmp";
+        {
+            std::ofstream manifest(temp_name, std::ios::trunc);
+            manifest << generation << '\n' << ranges.size() << '\n';
+            for (const auto &range: ranges) {
+                manifest << range.base.file_name << ' ' << range.base.true_size << ' ' << range.base.file_size << ' '
+                         << range.runs.size();
+                for (const auto &run: range.runs) {
+                    manifest << ' ' << run.size();
+                    for (const auto &f: run) {
+                        manifest << ' ' << f.file_name << ' ' << f.true_size << ' ' << f.file_size;
+                    }
+                }
+                manifest << '\n';
+            }
+            manifest.flush();
+            CHECK(manifest.good()) << "Cannot write " << temp_name;
+        }
+        SYSCALL(rename(temp_name.c_str(), manifest_name.c_str()));
+        auto current = AllFiles();
+        std::sort(current.begin(), current.end());
+        for (const auto &f: old_files) {
+            if (!std::binary_search(current.begin(), current.end(), f)) {
+                SYSCALL(unlink(f.c_str()));
+            }
+        }
+    }
+};
+
+#endif //SORTING_SORTED_DATASET_H
@@ -8,14 +8,30 @@
 #include <string>
 
 #include "absl/log/log.h"
+#include "configs.h"
+#include "benchmarks/in_memory_benchmarks.h"
 #include "sequence_algorithms/reduce.h"
 #include "sequence_algorithms/map.h"
 #include "sequence_algorithms/filter.h"
+#include "sequence_algorithms/top_k.h"
+#include "sequence_algorithms/scan.h"
+#include "sequence_algorithms/external_sequence.h"
+#include "sequence_algorithms/find.h"
+#include "sequence_algorithms/zip_with.h"
 
 parlay::monoid monoid([](size_t a, size_t b) {
     return a ^ b;
 }, 0);
 
+// largest in-memory run that is comparable to the external one; maps need room for both input and output
+size_t InMemoryCeilingSize(const std::vector<FileInfo> &files) {
+    size_t n = 0;
+    for (const auto &f: files) {
+        n += f.true_size / sizeof(size_t);
+    }
+    return std::max(1UL, std::min(n, MAIN_MEMORY_SIZE / sizeof(size_t) / 4));
+}
+
 void RunReduce(int argc, char **argv) {
     CHECK(argc >= 3);
     std::string prefix(argv[2]);
@@ -27,8 +43,23 @@ void RunReduce(int argc, char **argv) {
     auto result = Reduce<size_t>(files, monoid);
     double time = timer.next_time();
     double throughput = GetThroughput(files, time);
+    timer.next("Start block reduce");
+    auto block_result = Reduce<size_t>(files, monoid, [](const size_t *in, size_t n) {
+        size_t result = 0;
+        for (size_t i = 0; i < n; i++) {
+            result ^= in[i];
+        }
+        return result;
+    });
+    double block_time = timer.next_time();
+    CHECK(block_result == result) << "Block reduce returned " << block_result << " instead of " << result;
+    size_t n = InMemoryCeilingSize(files);
+    double ceiling = GetThroughput(n * sizeof(size_t), InMemoryReduceTime(n));
     std::cout << "Time: " << time << "\n";
     std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "Block time: " << block_time << "\n";
+    std::cout << "Block throughput: " << GetThroughput(files, block_time) << "GB\n";
+    std::cout << "In-memory ceiling: " << ceiling << "GB\n";
     std::cout << "Result: " << result << '\n';
 }
 
@@ -44,8 +75,21 @@ void RunMap(int argc, char **argv) {
     Map<size_t, size_t>(files, result_prefix, [](size_t num) { return num / 2; });
     double time = timer.next_time();
     double throughput = GetThroughput(files, time);
+    // writes the same result again, so verify_map checks the block version
+    timer.next("Start block map");
+    Map<size_t, size_t>(files, result_prefix, [](const size_t *in, size_t *out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = in[i] / 2;
+        }
+    });
+    double block_time = timer.next_time();
+    size_t n = InMemoryCeilingSize(files);
+    double ceiling = GetThroughput(n * sizeof(size_t), InMemoryMapTime(n));
     std::cout << "Time: " << time << "\n";
     std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "Block time: " << block_time << "\n";
+    std::cout << "Block throughput: " << GetThroughput(files, block_time) << "GB\n";
+    std::cout << "In-memory ceiling: " << ceiling << "GB\n";
 }
 
 void VerifyMap(int argc, char **argv) {
@@ -103,7 +147,302 @@ void RunFilter(int argc, char **argv) {
     GetFileInfo(files);
     timer.next("Start filter");
     Filter<size_t>(files, result_prefix, [](size_t num) { return num % 10 == 0; });
-    timer.next("Finish filter");
+    double time = timer.next_time();
+    double throughput = GetThroughput(files, time);
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << throughput << "GB\n";
+}
+
+void VerifyFilter(int argc, char **argv) {
+    CHECK(argc >= 4);
+    using T = size_t;
+    std::string source_prefix(argv[2]), result_prefix(argv[3]);
+    auto source_files = FindFiles(source_prefix);
+    auto result_files = FindFiles(result_prefix);
+    CHECK(source_files.size() == result_files.size());
+    GetFileInfo(source_files);
+    GetFileInfo(result_files, true);
+    parlay::parallel_for(0, source_files.size(), [&](size_t i) {
+        auto p1 = (T *) ReadEntireFile(source_files[i].file_name, source_files[i].file_size);
+        auto p2 = (T *) ReadEntireFile(result_files[i].file_name, result_files[i].file_size);
+        auto expected = parlay::filter(parlay::make_slice(p1, p1 + source_files[i].true_size / sizeof(T)),
+                                       [](size_t num) { return num % 10 == 0; });
+        size_t n = result_files[i].true_size / sizeof(T);
+        CHECK(n == expected.size()) << "Size mismatch for file " << i << ": "
+                                    << "expected " << expected.size() << " actual " << n;
+        for (size_t j = 0; j < n; j++) {
+            CHECK(p2[j] == expected[j]) << "For file " << i << " index " << j << ": "
+                                        << "expected " << expected[j] << " actual " << p2[j];
+        }
+        free(p1);
+        free(p2);
+    });
+    LOG(INFO) << "Test passed";
+}
+
+void RunTopK(int argc, char **argv) {
+    CHECK(argc >= 4);
+    std::string prefix(argv[2]);
+    size_t k = ParseLong(argv[3]);
+    parlay::internal::timer timer("Top k");
+    timer.next("Start prep");
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    timer.next("Start top k");
+    auto result = TopK<size_t>(files, k, std::less<>());
+    double time = timer.next_time();
+    double throughput = GetThroughput(files, time);
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "Smallest of the top " << result.size() << ": " << (result.empty() ? 0 : result.back()) << '\n';
+}
+
+void VerifyTopK(int argc, char **argv) {
+    CHECK(argc >= 4);
+    using T = size_t;
+    std::string prefix(argv[2]);
+    size_t k = ParseLong(argv[3]);
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    auto result = TopK<T>(files, k, std::less<>());
+    auto expected = parlay::sort(parlay::flatten(parlay::map(files, [](const FileInfo &file) {
+        auto ptr = (T *) ReadEntireFile(file.file_name, file.file_size);
+        parlay::sequence<T> data(ptr, ptr + file.true_size / sizeof(T));
+        free(ptr);
+        return data;
+    })), std::greater<>());
+    CHECK(result.size() == std::min(k, expected.size())) << "Expected " << std::min(k, expected.size())
+                                                         << " elements, got " << result.size();
+    for (size_t i = 0; i < result.size(); i++) {
+        CHECK(result[i] == expected[i]) << "At index " << i << ": expected " << expected[i] << " actual " << result[i];
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunScan(int argc, char **argv) {
+    CHECK(argc >= 4);
+    std::string prefix(argv[2]);
+    std::string result_prefix(argv[3]);
+    parlay::internal::timer timer("Scan");
+    timer.next("Start prep");
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    timer.next("Start scan");
+    auto total = Scan<size_t>(files, result_prefix, parlay::plus<size_t>());
+    double time = timer.next_time();
+    double throughput = GetThroughput(files, time);
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "Total: " << total << '\n';
+}
+
+void VerifyScan(int argc, char **argv) {
+    CHECK(argc >= 4);
+    using T = size_t;
+    std::string source_prefix(argv[2]), result_prefix(argv[3]);
+    auto source_files = FindFiles(source_prefix);
+    auto result_files = FindFiles(result_prefix);
+    CHECK(source_files.size() == result_files.size());
+    GetFileInfo(source_files);
+    GetFileInfo(result_files);
+    T sum = 0;
+    for (size_t i = 0; i < source_files.size(); i++) {
+        size_t n = source_files[i].true_size / sizeof(T);
+        CHECK(result_files[i].true_size >= n * sizeof(T)) << "Result file " << i << " is too small";
+        auto p1 = (T *) ReadEntireFile(source_files[i].file_name, source_files[i].file_size);
+        auto p2 = (T *) ReadEntireFile(result_files[i].file_name, result_files[i].file_size);
+        for (size_t j = 0; j < n; j++) {
+            CHECK(p2[j] == sum) << "For file " << i << " index " << j << ": "
+                                << "expected " << sum << " actual " << p2[j];
+            sum += p1[j];
+        }
+        free(p1);
+        free(p2);
+    }
+    LOG(INFO) << "Test passed";
+}
+
+void RunFind(int argc, char **argv) {
+    CHECK(argc >= 4);
+    std::string prefix(argv[2]);
+    size_t value = ParseLong(argv[3]);
+    parlay::internal::timer timer("Find");
+    timer.next("Start prep");
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    timer.next("Start find");
+    auto result = FindFirst<size_t>(files, [&](size_t x) { return x == value; });
+    double time = timer.next_time();
+    std::cout << "Time: " << time << "\n";
+    if (result.has_value()) {
+        std::cout << "First position of " << value << ": " << *result << '\n';
+    } else {
+        std::cout << value << " not found\n";
+    }
+}
+
+void VerifyFind(int argc, char **argv) {
+    CHECK(argc >= 3);
+    using T = size_t;
+    std::string prefix(argv[2]);
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    auto input = parlay::flatten(parlay::map(files, [](const FileInfo &file) {
+        auto ptr = (T *) ReadEntireFile(file.file_name, file.file_size);
+        parlay::sequence<T> data(ptr, ptr + file.true_size / sizeof(T));
+        free(ptr);
+        return data;
+    }));
+    CHECK(!input.empty());
+    // values at the start, middle and end of the input, and one that is not in it
+    auto max_value = parlay::reduce(input, parlay::maxm<T>());
+    for (T value: {input[0], input[input.size() / 2], input.back(), max_value + 1}) {
+        const auto equal = [&](T x) { return x == value; };
+        auto first = parlay::find_if(input, equal) - input.begin();
+        bool found = (size_t) first < input.size();
+        auto result = FindFirst<T>(files, equal);
+        CHECK(result.has_value() == found) << "FindFirst(" << value << ") expected found = " << found;
+        CHECK(!found || *result == (size_t) first) << "FindFirst(" << value << "): expected " << first
+                                                   << " actual " << *result;
+        auto any = FindAny<T>(files, equal);
+        CHECK(any.has_value() == found) << "FindAny(" << value << ") expected found = " << found;
+        CHECK(!found || input[*any] == value) << "FindAny(" << value << ") returned " << *any
+                                              << " which holds " << input[*any];
+        CHECK(Any<T>(files, equal) == found);
+        auto count = parlay::count_if(input, equal);
+        for (size_t limit: {1UL, 2UL, 1000UL}) {
+            CHECK(CountUntil<T>(files, equal, limit) == std::min(count, limit))
+                << "CountUntil(" << value << ", " << limit << ")";
+        }
+    }
+    CHECK(All<T>(files, [&](T x) { return x <= max_value; }));
+    CHECK(!All<T>(files, [&](T x) { return x < max_value; }));
+    LOG(INFO) << "Test passed";
+}
+
+size_t ZipFunction(size_t a, size_t b) {
+    return a * 3 + (b >> 1);
+}
+
+void RunZipWith(int argc, char **argv) {
+    CHECK(argc >= 5);
+    std::string a_prefix(argv[2]), b_prefix(argv[3]), result_prefix(argv[4]);
+    parlay::internal::timer timer("Zip with");
+    timer.next("Start prep");
+    auto a_files = FindFiles(a_prefix), b_files = FindFiles(b_prefix);
+    GetFileInfo(a_files);
+    GetFileInfo(b_files);
+    timer.next("Start zip with");
+    ZipWith<size_t, size_t, size_t>(a_files, b_files, result_prefix, ZipFunction);
+    double time = timer.next_time();
+    double throughput = GetThroughput(a_files, time) + GetThroughput(b_files, time);
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << throughput << "GB\n";
+}
+
+void VerifyZipWith(int argc, char **argv) {
+    CHECK(argc >= 5);
+    using T = size_t;
+    std::string a_prefix(argv[2]), b_prefix(argv[3]), result_prefix(argv[4]);
+    auto a_files = FindFiles(a_prefix), b_files = FindFiles(b_prefix), result_files = FindFiles(result_prefix);
+    CHECK(a_files.size() == result_files.size() && b_files.size() == result_files.size());
+    GetFileInfo(a_files);
+    GetFileInfo(b_files);
+    GetFileInfo(result_files);
+    parlay::parallel_for(0, a_files.size(), [&](size_t i) {
+        size_t n = a_files[i].true_size / sizeof(T);
+        CHECK(result_files[i].true_size >= n * sizeof(T)) << "Result file " << i << " is too small";
+        auto a = (T *) ReadEntireFile(a_files[i].file_name, a_files[i].file_size);
+        auto b = (T *) ReadEntireFile(b_files[i].file_name, b_files[i].file_size);
+        auto result = (T *) ReadEntireFile(result_files[i].file_name, result_files[i].file_size);
+        for (size_t j = 0; j < n; j++) {
+            CHECK(result[j] == ZipFunction(a[j], b[j])) << "For file " << i << " index " << j << ": "
+                                                        << "expected " << ZipFunction(a[j], b[j])
+                                                        << " actual " << result[j];
+        }
+        free(a);
+        free(b);
+        free(result);
+    });
+    LOG(INFO) << "Test passed";
+}
+
+// map -> filter -> reduce chain shared by the pipeline commands
+size_t PipelineMap(size_t x) {
+    return x * 0x9E3779B97F4A7C15UL;
+}
+
+bool PipelinePredicate(size_t x) {
+    return (x >> 60) < 4;
+}
+
+void RunPipeline(int argc, char **argv) {
+    CHECK(argc >= 3);
+    std::string prefix(argv[2]);
+    parlay::internal::timer timer("Pipeline");
+    timer.next("Start prep");
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    timer.next("Start pipeline");
+    auto result = ExternalSequence<size_t>(files).Map(PipelineMap).Filter(PipelinePredicate).Reduce(monoid);
+    double time = timer.next_time();
+    double throughput = GetThroughput(files, time);
+    std::cout << "Time: " << time << "\n";
+    std::cout << "Throughput: " << throughput << "GB\n";
+    std::cout << "Result: " << result << '\n';
+}
+
+void VerifyPipeline(int argc, char **argv) {
+    CHECK(argc >= 4);
+    using T = size_t;
+    std::string prefix(argv[2]), result_prefix(argv[3]);
+    auto files = FindFiles(prefix);
+    GetFileInfo(files);
+    auto input = parlay::flatten(parlay::map(files, [](const FileInfo &file) {
+        auto ptr = (T *) ReadEntireFile(file.file_name, file.file_size);
+        parlay::sequence<T> data(ptr, ptr + file.true_size / sizeof(T));
+        free(ptr);
+        return data;
+    }));
+    const auto read_all = [](const ExternalSequence<T> &sequence) {
+        return parlay::flatten(parlay::map(sequence.Files(), [](const FileInfo &file) {
+            auto ptr = (T *) ReadEntireFile(file.file_name, file.file_size);
+            parlay::sequence<T> data(ptr, ptr + file.true_size / sizeof(T));
+            free(ptr);
+            return data;
+        }));
+    };
+    const auto check_equal = [](const parlay::sequence<T> &expected, const parlay::sequence<T> &actual,
+                                const std::string &name) {
+        CHECK(expected.size() == actual.size()) << name << ": expected " << expected.size() << " elements, got "
+                                                << actual.size();
+        for (size_t i = 0; i < expected.size(); i++) {
+            CHECK(expected[i] == actual[i]) << name << " at index " << i << ": expected " << expected[i]
+                                            << " actual " << actual[i];
+        }
+    };
+
+    ExternalSequence<T> sequence(files);
+    auto pipeline = sequence.Map(PipelineMap).Filter(PipelinePredicate);
+    auto expected = parlay::filter(parlay::map(input, PipelineMap), PipelinePredicate);
+    T expected_sum = parlay::reduce(expected, monoid);
+    T sum = pipeline.Reduce(monoid);
+    CHECK(sum == expected_sum) << "Reduce: expected " << expected_sum << " actual " << sum;
+    check_equal(expected, read_all(pipeline.Materialize(result_prefix + "_filter")), "Materialize");
+
+    // positions are preserved without a filter, so the sequence can be zipped with the input
+    auto zipped = sequence.Zip(sequence.Map(PipelineMap)).Map([](const std::pair<T, T> &p) {
+        return p.first + p.second;
+    });
+    auto [prefix_sums, total] = zipped.Scan(parlay::plus<T>(), result_prefix + "_scan");
+    auto expected_sums = parlay::map(input, [](T x) { return x + PipelineMap(x); });
+    T expected_total = parlay::scan_inplace(expected_sums);
+    CHECK(total == expected_total) << "Scan: expected total " << expected_total << " actual " << total;
+    check_equal(expected_sums, read_all(prefix_sums), "Scan");
+
+    parlay::sort_inplace(expected);
+    check_equal(expected, read_all(pipeline.Sort(result_prefix + "_sort", std::less<>())), "Sort");
+    LOG(INFO) << "Test passed";
 }
 
 int main(int argc, char **argv) {
@@ -119,7 +458,18 @@ int main(int argc, char **argv) {
             {"verify_reduce", VerifyReduce},
             {"map",           RunMap},
             {"verify_map",    VerifyMap},
-            {"filter",        RunFilter}
+            {"filter",        RunFilter},
+            {"verify_filter", VerifyFilter},
+            {"scan",          RunScan},
+            {"verify_scan",   VerifyScan},
+            {"top_k",         RunTopK},
+            {"verify_top_k",  VerifyTopK},
+            {"find",            RunFind},
+            {"verify_find",     VerifyFind},
+            {"zip_with",        RunZipWith},
+            {"verify_zip_with", VerifyZipWith},
+            {"pipeline",        RunPipeline},
+            {"verify_pipeline", VerifyPipeline}
         }
     );
     if (commands.count(argv[1])) {
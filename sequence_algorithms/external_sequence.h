@@ -0,0 +1,274 @@
+#ifndef SORTING_EXTERNAL_SEQUENCE_H
+#define SORTING_EXTERNAL_SEQUENCE_H
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <cstring>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "utils/file_info.h"
+#include "utils/file_utils.h"
+#include "utils/unordered_file_reader.h"
+#include "sequence_algorithms/filter.h"
+#include "sequence_algorithms/scan.h"
+#include "scatter_gather_algorithms/sample_sort.h"
+
+/**
+ * A lazy sequence of T computed from files that hold S.
+ *
+ * Element-wise operations (Map, Filter, Zip) only extend a chunk function that turns a chunk of S read from disk into
+ * a chunk of T in memory. Nothing is read until a terminal operation runs. Reduce and Scan then evaluate the whole
+ * chain in a single UnorderedFileReader pass (two for Scan). Data only reaches the disk at Materialize, Scan and Sort
+ * boundaries.
+ *
+ * @tparam T Type of the elements of the sequence
+ * @tparam S Type stored in the underlying files
+ */
+template<typename T, typename S = T>
+class ExternalSequence {
+public:
+    /**
+     * <code>size_t f(const S *in, size_t n, size_t index, T *out)</code>: compute the elements of a chunk of n source
+     * elements whose first element is at global position <code>index</code>. Writes the resulting elements to the
+     * front of out and returns how many there are. <code>out</code> may alias <code>in</code> when S and T are the
+     * same type.
+     */
+    typedef std::function<size_t(const S *, size_t, size_t, T *)> ChunkFunction;
+
+    /**
+     * A sequence that holds the contents of the files
+     *
+     * @param files true_size must be populated (see GetFileInfo)
+     */
+    explicit ExternalSequence(std::vector<FileInfo> files) : source_files(std::move(files)) {
+        static_assert(std::is_same_v<T, S>, "Sequences over files hold the type stored in the files");
+        ComputeBeforeSize(source_files);
+        chunk_function = [](const S *in, size_t n, size_t index, T *out) {
+            if ((const void *) in != (const void *) out) {
+                memcpy(out, in, n * sizeof(T));
+            }
+            return n;
+        };
+    }
+
+    /**
+     * Files holding the source elements of this sequence
+     */
+    const std::vector<FileInfo> &Files() const {
+        return source_files;
+    }
+
+    /**
+     * Number of elements in the sequence. Not known for filtered sequences until they are materialized.
+     */
+    size_t Size() const {
+        CHECK(!filtered) << "The size of a filtered sequence is only known after it is materialized";
+        size_t n = 0;
+        for (const auto &f: source_files) {
+            n += f.true_size / sizeof(S);
+        }
+        return n;
+    }
+
+    /**
+     * Lazily apply f to every element
+     */
+    template<typename F, typename R = std::decay_t<std::invoke_result_t<F, const T &>>>
+    ExternalSequence<R, S> Map(F f) const {
+        ExternalSequence<R, S> result(*this);
+        result.identity = false;
+        result.chunk_function = [prev = chunk_function, f](const S *in, size_t n, size_t index, R *out) {
+            if constexpr (std::is_same_v<T, R>) {
+                // reuse the output buffer for the previous stage
+                size_t m = prev(in, n, index, out);
+                for (size_t i = 0; i < m; i++) {
+                    out[i] = f(out[i]);
+                }
+                return m;
+            } else {
+                auto values = parlay::sequence<T>::uninitialized(n);
+                size_t m = prev(in, n, index, values.data());
+                for (size_t i = 0; i < m; i++) {
+                    out[i] = f(values[i]);
+                }
+                return m;
+            }
+        };
+        return result;
+    }
+
+    /**
+     * Lazily keep the elements for which the predicate returns true
+     */
+    template<typename P>
+    ExternalSequence Filter(P predicate) const {
+        ExternalSequence result(*this);
+        result.chunk_function = [prev = chunk_function, predicate](const S *in, size_t n, size_t index, T *out) {
+            size_t m = prev(in, n, index, out);
+            size_t survivors = 0;
+            for (size_t i = 0; i < m; i++) {
+                out[survivors] = out[i];
+                survivors += predicate(out[i]);
+            }
+            return survivors;
+        };
+        result.filtered = true;
+        result.identity = false;
+        return result;
+    }
+
+    /**
+     * Lazily pair up the elements of two sequences of the same length. The elements of the other sequence are read
+     * alongside each chunk of this one. Neither sequence may be filtered, since positions need to line up.
+     *
+     * The files of the other sequence are opened once and stay open until the last copy of the chunk function is
+     * gone, so each chunk costs a single positioned read per file it spans.
+     */
+    template<typename U, typename S2>
+    ExternalSequence<std::pair<T, U>, S> Zip(const ExternalSequence<U, S2> &other) const {
+        CHECK(!filtered && !other.filtered) << "Filtered sequences cannot be zipped";
+        CHECK(Size() == other.Size()) << "Zipping sequences of different lengths: " << Size() << " and "
+                                      << other.Size();
+        ExternalSequence<std::pair<T, U>, S> result(*this);
+        auto b_fds = std::shared_ptr<std::vector<int>>(new std::vector<int>(OpenFiles(other.source_files)),
+                                                       [](std::vector<int> *fds) {
+                                                           CloseFiles(*fds);
+                                                           delete fds;
+                                                       });
+        result.chunk_function = [a = chunk_function, b = other.chunk_function, b_files = other.source_files, b_fds](
+                const S *in, size_t n, size_t index, std::pair<T, U> *out) {
+            auto a_values = parlay::sequence<T>::uninitialized(n);
+            a(in, n, index, a_values.data());
+            auto b_source = parlay::sequence<S2>::uninitialized(n);
+            ReadFileRange(b_files, *b_fds, index * sizeof(S2), n * sizeof(S2), b_source.data());
+            auto b_values = parlay::sequence<U>::uninitialized(n);
+            b(b_source.data(), n, index, b_values.data());
+            for (size_t i = 0; i < n; i++) {
+                out[i] = {a_values[i], b_values[i]};
+            }
+            return n;
+        };
+        return result;
+    }
+
+    /**
+     * Sum all elements in a single pass over the source files
+     */
+    template<typename Monoid>
+    T Reduce(Monoid monoid) const {
+        auto input_files = NumberedFiles();
+        UnorderedFileReader<S> reader;
+        reader.PrepFiles(input_files);
+        // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
+        reader.Start(UnorderedReaderConfig(10, 4, 8));
+        return parlay::reduce(parlay::tabulate(parlay::num_workers(), [&](size_t worker_index) {
+            T result = monoid.identity;
+            while (true) {
+                auto [ptr, n, file_index, element_index] = reader.Poll();
+                if (ptr == nullptr) {
+                    break;
+                }
+                size_t index = input_files[file_index].before_size / sizeof(S) + element_index;
+                if constexpr (std::is_same_v<S, T>) {
+                    size_t m = chunk_function(ptr, n, index, ptr);
+                    for (size_t i = 0; i < m; i++) {
+                        result = monoid(result, ptr[i]);
+                    }
+                } else {
+                    auto values = parlay::sequence<T>::uninitialized(n);
+                    size_t m = chunk_function(ptr, n, index, values.data());
+                    for (size_t i = 0; i < m; i++) {
+                        result = monoid(result, values[i]);
+                    }
+                }
+                reader.allocator.Free(ptr);
+            }
+            return result;
+        }, 1), monoid);
+    }
+
+    /**
+     * Evaluate the sequence and write it to disk. Output file i holds the elements computed from source file i.
+     */
+    ExternalSequence<T> Materialize(const std::string &result_prefix) const {
+        std::vector<std::string> out_files;
+        for (size_t i = 0; i < source_files.size(); i++) {
+            out_files.push_back(GetFileName(result_prefix, i));
+        }
+        return ExternalSequence<T>(FilterChunks<S, T>(source_files, out_files, chunk_function));
+    }
+
+    /**
+     * Exclusive prefix sum, evaluated in two passes over the source files. Filtered sequences are materialized first
+     * (with the suffix "_filtered") since their positions are only known after a full pass.
+     *
+     * @return The prefix sums and the sum of all elements
+     */
+    template<typename Monoid>
+    std::pair<ExternalSequence<T>, T> Scan(Monoid monoid, const std::string &result_prefix) const {
+        if (filtered) {
+            return Materialize(result_prefix + "_filtered").Scan(monoid, result_prefix);
+        }
+        T total = ScanChunks<S, T>(source_files, result_prefix, monoid, chunk_function);
+        std::vector<FileInfo> results;
+        for (size_t i = 0; i < source_files.size(); i++) {
+            size_t true_size = source_files[i].true_size / sizeof(S) * sizeof(T);
+            results.emplace_back(GetFileName(result_prefix, i), i, true_size, AlignUp(true_size));
+        }
+        return {ExternalSequence<T>(results), total};
+    }
+
+    /**
+     * Sort the sequence with SampleSort. Sequences that are not plain files are materialized first (with the suffix
+     * "_unsorted").
+     */
+    template<typename Comparator>
+    ExternalSequence<T> Sort(const std::string &result_prefix, Comparator comp) const {
+        if (!identity) {
+            return Materialize(result_prefix + "_unsorted").Sort(result_prefix, comp);
+        }
+        // SampleSort takes an unknown true_size to mean the whole file, so leave out empty files
+        std::vector<FileInfo> files;
+        for (const auto &f: source_files) {
+            if (f.true_size > 0) {
+                files.push_back(f);
+            }
+        }
+        return ExternalSequence<T>(SampleSort<T>().Sort(files, result_prefix, comp));
+    }
+
+private:
+    template<typename, typename> friend class ExternalSequence;
+
+    template<typename T2>
+    explicit ExternalSequence(const ExternalSequence<T2, S> &other) : source_files(other.source_files),
+                                                                      filtered(other.filtered),
+                                                                      identity(false) {}
+
+    /**
+     * The reader reports file_index, so number the files by their position
+     */
+    std::vector<FileInfo> NumberedFiles() const {
+        auto files = source_files;
+        for (size_t i = 0; i < files.size(); i++) {
+            files[i].file_index = i;
+        }
+        return files;
+    }
+
+    std::vector<FileInfo> source_files;
+    ChunkFunction chunk_function;
+    // whether elements may have been dropped, in which case positions no longer line up with the source
+    bool filtered = false;
+    // whether the sequence is exactly the contents of the files
+    bool identity = true;
+};
+
+#endif //SORTING_EXTERNAL_SEQUENCE_H
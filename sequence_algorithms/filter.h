@@ -5,89 +5,224 @@
 #ifndef SORTING_FILTER_H
 #define SORTING_FILTER_H
 
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <type_traits>
+
 #include "utils/file_info.h"
 #include "utils/unordered_file_reader.h"
 #include "utils/unordered_file_writer.h"
 
 #include "parlay/primitives.h"
 
-template<typename T>
-FileInfo FilterFile(const FileInfo &in_file, const std::string &out_file, const std::function<bool(const T)> predicate) {
-    struct QueueData {
-        T *ptr;
-        size_t size;
-        size_t index;
-
-        QueueData(T *ptr, size_t size, size_t index) : ptr(ptr), size(size), index(index) {}
+/**
+ * Compute a possibly smaller chunk of output values from each chunk of the input and write the results of each input
+ * file to its own output file, preserving the order of the elements.
+ *
+ * All workers poll chunks from a single reader and run f on them, so the work is done in parallel regardless of the
+ * number of files. The output offset of a chunk is the prefix sum of the output counts of the chunks before it in the
+ * same file. Chunks are committed in order by whichever worker finds the next chunk ready. The others just leave
+ * their chunk behind, so nobody waits for a reorder queue. Commits append to a block-aligned staging buffer that is
+ * written at its exact offset through UnorderedFileWriter.
+ *
+ * Like the OrderedFileWriter, every output file ends with a partial block that holds an end-of-file marker.
+ *
+ * @tparam S Type stored in the input files
+ * @tparam T Type written to the output files
+ * @param files Input files; true_size must be populated
+ * @param out_files Name of the output file of each input file
+ * @param f <code>size_t f(const S *in, size_t n, size_t index, T *out)</code> writes the output values of a chunk
+ * whose first element is at global position <code>index</code> to the front of out and returns how many there are.
+ * When S and T are the same type, <code>out == in</code>.
+ */
+template<typename S, typename T, typename ChunkFunction>
+std::vector<FileInfo> FilterChunks(const std::vector<FileInfo> &files,
+                                   const std::vector<std::string> &out_files,
+                                   ChunkFunction f) {
+    CHECK(files.size() == out_files.size());
+    constexpr size_t buffer_size_bytes = 4 << 20, buffer_size = buffer_size_bytes / sizeof(T);
+    struct Chunk {
+        S *source = nullptr;
+        T *data = nullptr;
+        size_t survivors = 0;
+        bool ready = false;
     };
-    const auto cmp = [](QueueData a, QueueData b) {
-        return a.index > b.index;
+    struct OutputFile {
+        std::mutex lock;
+        std::vector<Chunk> chunks;
+        // first chunk that has not been committed
+        size_t frontier = 0;
+        bool committing = false;
+        // only touched by the committing worker
+        T *buffer = nullptr;
+        size_t buffer_index = 0;
+        size_t write_count = 0;
+        size_t true_size = 0;
     };
-    UnorderedFileReader<T> reader;
-    reader.PrepFiles({in_file});
-    reader.Start();
-    UnorderedFileWriter<T> writer(out_file);
-    std::priority_queue<QueueData, std::vector<QueueData>, decltype(cmp)> queue(cmp);
-    constexpr size_t buffer_size_bytes = 4 << 20, buffer_size = buffer_size_bytes / sizeof(T);
-    size_t buffer_index = 0;
-    auto buffer = (T*)aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, buffer_size_bytes);
-    size_t write_count = 0;
-    size_t next_index = 0;
-    while (true) {
-        auto [ptr, size, _, index] = reader.Poll();
-        if (ptr == nullptr) {
-            CHECK(queue.empty());
-            break;
+    std::vector<OutputFile> outputs(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        // the reader hands out every READER_READ_SIZE bytes of real data as one chunk
+        outputs[i].chunks.resize((files[i].true_size + READER_READ_SIZE - 1) / READER_READ_SIZE);
+        outputs[i].buffer = (T *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, buffer_size_bytes);
+    }
+    // the reader reports file_index, so number the files by their position
+    auto input_files = files;
+    for (size_t i = 0; i < input_files.size(); i++) {
+        input_files[i].file_index = i;
+    }
+    ComputeBeforeSize(input_files);
+    UnorderedFileReader<S> reader;
+    reader.PrepFiles(input_files);
+    reader.Start(UnorderedReaderConfig(5, 16, 8));
+    UnorderedWriterConfig config;
+    config.io_uring_size = 8;
+    config.num_threads = std::min(files.size(), 5UL);
+    UnorderedFileWriter<T> writer;
+    writer.Start(out_files, config);
+
+    // append a chunk to the staging buffer of its file, flushing full buffers at their final offset
+    const auto commit = [&](size_t file_index, Chunk chunk) {
+        auto &out = outputs[file_index];
+        size_t i = 0;
+        while (i < chunk.survivors) {
+            size_t count = std::min(chunk.survivors - i, buffer_size - out.buffer_index);
+            std::copy(chunk.data + i, chunk.data + i + count, out.buffer + out.buffer_index);
+            out.buffer_index += count;
+            i += count;
+            if (out.buffer_index == buffer_size) {
+                writer.Push(std::shared_ptr<T>(out.buffer, free), buffer_size,
+                            file_index, out.write_count * buffer_size_bytes);
+                out.write_count++;
+                out.buffer = (T *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, buffer_size_bytes);
+                out.buffer_index = 0;
+            }
+        }
+        out.true_size += chunk.survivors * sizeof(T);
+        if constexpr (!std::is_same_v<S, T>) {
+            free(chunk.data);
         }
-        queue.emplace(ptr, size, index);
-        while (!queue.empty()) {
-            auto top = queue.top();
-            if (top.index != next_index) {
+        reader.allocator.Free(chunk.source);
+    };
+
+    parlay::parallel_for(0, parlay::num_workers(), [&](size_t _) {
+        while (true) {
+            auto [ptr, n, file_index, element_index] = reader.Poll();
+            if (ptr == nullptr) {
                 break;
             }
-            queue.pop();
-            next_index += size;
-            // process buffer
-            size_t i = 0;
-            while (i < size) {
-                if (predicate(ptr[i])) {
-                    buffer[buffer_index] = ptr[i];
-                    buffer_index++;
-                }
-                if (buffer_size == buffer_index) {
-                    writer.Push(std::shared_ptr<T>(buffer, free), buffer_size);
-                    write_count++;
-                    buffer = (T*)aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, buffer_size_bytes);
-                    buffer_index = 0;
-                }
-                i++;
+            T *data;
+            if constexpr (std::is_same_v<S, T>) {
+                data = ptr;
+            } else {
+                data = (T *) malloc(n * sizeof(T));
             }
+            size_t survivors = f(ptr, n, input_files[file_index].before_size / sizeof(S) + element_index, data);
+            auto &out = outputs[file_index];
+            std::unique_lock lock(out.lock);
+            out.chunks[element_index * sizeof(S) / READER_READ_SIZE] = {ptr, data, survivors, true};
+            if (out.committing) {
+                // the worker currently committing this file will pick up the chunk
+                continue;
+            }
+            out.committing = true;
+            while (out.frontier < out.chunks.size() && out.chunks[out.frontier].ready) {
+                Chunk chunk = out.chunks[out.frontier++];
+                lock.unlock();
+                commit(file_index, chunk);
+                lock.lock();
+            }
+            out.committing = false;
         }
+    }, 1);
+
+    std::vector<FileInfo> results;
+    for (size_t i = 0; i < files.size(); i++) {
+        auto &out = outputs[i];
+        CHECK(out.frontier == out.chunks.size()) << "Only " << out.frontier << " out of " << out.chunks.size()
+                                                 << " chunks of " << files[i].file_name << " were processed";
+        size_t end_size = AlignUp(out.buffer_index * sizeof(T) + METADATA_SIZE);
+        if (end_size > buffer_size_bytes) {
+            // rare situation where the size of the metadata exceeds sizeof(T), resulting
+            // in insufficient buffer size; realloc would not keep the O_DIRECT alignment
+            auto larger = (T *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, end_size);
+            std::copy(out.buffer, out.buffer + out.buffer_index, larger);
+            free(out.buffer);
+            out.buffer = larger;
+        }
+        MakeFileEndMarker((unsigned char *) out.buffer, end_size, out.buffer_index * sizeof(T));
+        writer.Push(std::shared_ptr<T>(out.buffer, free), end_size / sizeof(T),
+                    i, out.write_count * buffer_size_bytes);
+        results.emplace_back(out_files[i], files[i].file_index, out.true_size,
+                             out.write_count * buffer_size_bytes + end_size);
     }
-    size_t end_size = AlignUp(buffer_index * sizeof(T) + METADATA_SIZE);
-    if (end_size > buffer_size_bytes) {
-        // rare situation where the size of the metadata exceeds sizeof(T), resulting
-        // in insufficient buffer size
-        buffer = (T*)realloc(buffer, end_size);
-    }
-    MakeFileEndMarker((unsigned char *) buffer,
-                      end_size,
-                      buffer_index * sizeof(T));
-    writer.Push(std::shared_ptr<T>(buffer, free), end_size);
     writer.Wait();
-    size_t file_size = (write_count + 1) * buffer_size_bytes;
-    size_t true_size = write_count * buffer_size_bytes + buffer_index * sizeof(T);
-    return {out_file, in_file.file_index, true_size, file_size};
+    ComputeBeforeSize(results);
+    return results;
+}
+
+/**
+ * Filter each input file into its own output file, preserving the order of the elements.
+ * Survivors of a chunk are compacted in place and committed in order (see FilterChunks).
+ *
+ * @param files Input files; true_size must be populated
+ * @param out_files Name of the output file of each input file
+ */
+template<typename T>
+std::vector<FileInfo> FilterFiles(const std::vector<FileInfo> &files,
+                                  const std::vector<std::string> &out_files,
+                                  const std::function<bool(const T)> predicate) {
+    return FilterChunks<T, T>(files, out_files, [&](const T *in, size_t n, size_t index, T *out) {
+        size_t survivors = 0;
+        for (size_t i = 0; i < n; i++) {
+            out[survivors] = in[i];
+            survivors += predicate(in[i]);
+        }
+        return survivors;
+    });
+}
+
+/**
+ * Filter each input file into its own output file with a functor over contiguous blocks, which can be inlined and
+ * vectorized unlike a per-element predicate.
+ *
+ * @param f <code>size_t f(const T *in, T *out, size_t n)</code> writes the survivors of a block to the front of out
+ * and returns how many there are. <code>out == in</code>, so survivors are compacted in place.
+ */
+template<typename T, typename F>
+requires std::is_invocable_r_v<size_t, F, const T *, T *, size_t>
+std::vector<FileInfo> FilterFiles(const std::vector<FileInfo> &files,
+                                  const std::vector<std::string> &out_files,
+                                  F f) {
+    return FilterChunks<T, T>(files, out_files, [&](const T *in, size_t n, size_t index, T *out) {
+        return f(in, out, n);
+    });
+}
+
+template<typename T>
+FileInfo FilterFile(const FileInfo &in_file, const std::string &out_file, const std::function<bool(const T)> predicate) {
+    return FilterFiles<T>({in_file}, {out_file}, predicate)[0];
 }
 
 template<typename T>
 std::vector<FileInfo> Filter(const std::vector<FileInfo> &files,
                              const std::string &prefix,
                              const std::function<bool(const T)> predicate) {
-    auto result = parlay::map(parlay::iota(files.size()), [&](size_t i) {
-        return FilterFile(files[i], GetFileName(prefix, i), predicate);
-    }, 1);
-    return {result.begin(), result.end()};
+    std::vector<std::string> out_files;
+    for (size_t i = 0; i < files.size(); i++) {
+        out_files.push_back(GetFileName(prefix, i));
+    }
+    return FilterFiles<T>(files, out_files, predicate);
+}
+
+template<typename T, typename F>
+requires std::is_invocable_r_v<size_t, F, const T *, T *, size_t>
+std::vector<FileInfo> Filter(const std::vector<FileInfo> &files, const std::string &prefix, F f) {
+    std::vector<std::string> out_files;
+    for (size_t i = 0; i < files.size(); i++) {
+        out_files.push_back(GetFileName(prefix, i));
+    }
+    return FilterFiles<T>(files, out_files, f);
 }
 
 #endif //SORTING_FILTER_H
@@ -0,0 +1,171 @@
+#ifndef SORTING_FIND_H
+#define SORTING_FIND_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <limits>
+#include <algorithm>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "utils/file_info.h"
+#include "utils/file_utils.h"
+#include "utils/unordered_file_reader.h"
+
+/**
+ * Read chunks until f asks to stop, then cancel the reader so that no more data is read from disk.
+ *
+ * @param f <code>bool f(const T *in, size_t n, size_t index)</code> inspects a chunk whose first element is at global
+ * position <code>index</code> and returns true once the search is over
+ */
+template<typename T, typename F>
+void SearchChunks(const std::vector<FileInfo> &files, F f) {
+    // the reader reports file_index, so number the files by their position
+    auto input_files = files;
+    for (size_t i = 0; i < input_files.size(); i++) {
+        input_files[i].file_index = i;
+    }
+    ComputeBeforeSize(input_files);
+    UnorderedFileReader<T> reader;
+    reader.PrepFiles(input_files);
+    // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
+    reader.Start(UnorderedReaderConfig(10, 4, 8));
+    parlay::parallel_for(0, parlay::num_workers(), [&](size_t worker_index) {
+        while (true) {
+            auto [ptr, n, file_index, element_index] = reader.Poll();
+            if (ptr == nullptr) {
+                break;
+            }
+            bool done = f(ptr, n, input_files[file_index].before_size / sizeof(T) + element_index);
+            reader.allocator.Free(ptr);
+            if (done) {
+                reader.Cancel();
+            }
+        }
+    }, 1);
+}
+
+/**
+ * Find the position of some element that satisfies the predicate. Reading stops at the first match found by any
+ * worker, which is not necessarily the first match in the sequence.
+ *
+ * @return Global position of a match, or nothing if no element matches
+ */
+template<typename T, typename Predicate>
+std::optional<size_t> FindAny(const std::vector<FileInfo> &files, Predicate predicate) {
+    constexpr size_t NOT_FOUND = std::numeric_limits<size_t>::max();
+    std::atomic<size_t> result = NOT_FOUND;
+    SearchChunks<T>(files, [&](const T *in, size_t n, size_t index) {
+        if (result != NOT_FOUND) {
+            return true;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (predicate(in[i])) {
+                size_t expected = NOT_FOUND;
+                result.compare_exchange_strong(expected, index + i);
+                return true;
+            }
+        }
+        return false;
+    });
+    if (result == NOT_FOUND) {
+        return std::nullopt;
+    }
+    return result.load();
+}
+
+/**
+ * Find the position of the first element that satisfies the predicate.
+ *
+ * Chunks arrive in no particular order, so a match only ends the search once every chunk before it has been checked.
+ * Chunks after the best match so far are skipped without being inspected.
+ *
+ * @return Global position of the first match, or nothing if no element matches
+ */
+template<typename T, typename Predicate>
+std::optional<size_t> FindFirst(const std::vector<FileInfo> &files, Predicate predicate) {
+    constexpr size_t NOT_FOUND = std::numeric_limits<size_t>::max();
+    // global position of the first element of every chunk, in the order of the sequence
+    parlay::sequence<size_t> chunk_position;
+    size_t position = 0;
+    for (const auto &f: files) {
+        // the reader hands out every READER_READ_SIZE bytes of real data as one chunk
+        for (size_t offset = 0; offset < f.true_size; offset += READER_READ_SIZE) {
+            chunk_position.push_back(position + offset / sizeof(T));
+        }
+        position += f.true_size / sizeof(T);
+    }
+    std::atomic<size_t> best = NOT_FOUND;
+    std::vector<bool> done(chunk_position.size(), false);
+    // first chunk that has not been checked; guarded by lock
+    size_t frontier = 0;
+    std::mutex lock;
+    SearchChunks<T>(files, [&](const T *in, size_t n, size_t index) {
+        if (index < best) {
+            for (size_t i = 0; i < n && index + i < best; i++) {
+                if (predicate(in[i])) {
+                    size_t current = best;
+                    while (index + i < current && !best.compare_exchange_weak(current, index + i)) {}
+                    break;
+                }
+            }
+        }
+        size_t chunk = std::upper_bound(chunk_position.begin(), chunk_position.end(), index)
+                       - chunk_position.begin() - 1;
+        std::lock_guard guard(lock);
+        done[chunk] = true;
+        while (frontier < done.size() && done[frontier]) {
+            frontier++;
+        }
+        // every chunk before the one holding the best match has been checked
+        return frontier == done.size() || chunk_position[frontier] > best;
+    });
+    if (best == NOT_FOUND) {
+        return std::nullopt;
+    }
+    return best.load();
+}
+
+/**
+ * @return Whether any element satisfies the predicate
+ */
+template<typename T, typename Predicate>
+bool Any(const std::vector<FileInfo> &files, Predicate predicate) {
+    return FindAny<T>(files, predicate).has_value();
+}
+
+/**
+ * @return Whether every element satisfies the predicate; reading stops at the first counterexample
+ */
+template<typename T, typename Predicate>
+bool All(const std::vector<FileInfo> &files, Predicate predicate) {
+    return !Any<T>(files, [&](const T &t) { return !predicate(t); });
+}
+
+/**
+ * Count the elements that satisfy the predicate, but stop reading as soon as limit of them are found. Useful for
+ * checks such as "at least k matches".
+ *
+ * @return min(number of matches, limit)
+ */
+template<typename T, typename Predicate>
+size_t CountUntil(const std::vector<FileInfo> &files, Predicate predicate, size_t limit) {
+    if (limit == 0) {
+        return 0;
+    }
+    std::atomic<size_t> count = 0;
+    SearchChunks<T>(files, [&](const T *in, size_t n, size_t index) {
+        size_t matches = 0;
+        for (size_t i = 0; i < n; i++) {
+            matches += predicate(in[i]);
+        }
+        return count.fetch_add(matches) + matches >= limit;
+    });
+    return std::min(count.load(), limit);
+}
+
+#endif //SORTING_FIND_H
@@ -2,6 +2,9 @@
 #define SORTING_MAP_H
 
 #include <vector>
+#include <string>
+#include <functional>
+#include <type_traits>
 
 #include "parlay/primitives.h"
 #include "absl/log/log.h"
@@ -10,8 +13,20 @@
 #include "utils/unordered_file_reader.h"
 #include "utils/unordered_file_writer.h"
 
-template <typename T, typename R = T, bool in_place = sizeof(T) == sizeof(R)>
-void Map(std::vector<FileInfo> files, std::string result_prefix, std::function<R(T)> f) {
+/**
+ * Map every chunk of the input with a functor over contiguous blocks. Output file i holds the results of input file i
+ * at the same (element) offsets.
+ *
+ * Unlike the element-wise overload, f is a template parameter, so its loop can be inlined and auto-vectorized, or
+ * replaced with a hand-written SIMD kernel.
+ *
+ * @param f <code>void f(const T *in, R *out, size_t n)</code>. When T and R have the same size, the output is
+ * written in place and <code>out == in</code>.
+ */
+template<typename T, typename R = T, typename F>
+requires std::is_invocable_v<F, const T *, R *, size_t>
+void Map(std::vector<FileInfo> files, std::string result_prefix, F f) {
+    constexpr bool in_place = sizeof(T) == sizeof(R);
     UnorderedFileReader<T> reader;
     reader.PrepFiles(files);
     reader.Start(UnorderedReaderConfig(5, 16, 8));
@@ -26,24 +41,31 @@ void Map(std::vector<FileInfo> files, std::string result_prefix, std::function<R
             if (ptr == nullptr) {
                 break;
             }
-            R *result;
-            if (in_place) {
+            std::shared_ptr<R> result;
+            if constexpr (in_place) {
                 // FIXME: strict aliasing violation here?
-                for (size_t i = 0; i < n; i++) {
-                    ptr[i] = f(ptr[i]);
-                }
-                result = (R *) ptr;
+                f(ptr, (R *) ptr, n);
+                // the buffer belongs to the reader's allocator, so it goes back there once written
+                result = std::shared_ptr<R>((R *) ptr, [&](R *p) { reader.allocator.Free((T *) p); });
             } else {
-                result = (R *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, n * sizeof(R));
-                for (size_t i = 0; i < n; i++) {
-                    result[i] = f(ptr[i]);
-                }
+                result = std::shared_ptr<R>((R *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, AlignUp(n * sizeof(R))),
+                                            free);
+                f(ptr, result.get(), n);
                 reader.allocator.Free(ptr);
             }
-            writer.Push(std::shared_ptr<R>(result, free), n, file_index, element_index * sizeof(R));
+            writer.Push(result, n, file_index, element_index * sizeof(R));
         }
     }, 1);
     writer.Wait();
 }
 
+template <typename T, typename R = T>
+void Map(std::vector<FileInfo> files, std::string result_prefix, std::function<R(T)> f) {
+    Map<T, R>(std::move(files), std::move(result_prefix), [&](const T *in, R *out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = f(in[i]);
+        }
+    });
+}
+
 #endif //SORTING_MAP_H
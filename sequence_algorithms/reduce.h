@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <queue>
+#include <type_traits>
 
 #include "parlay/primitives.h"
 #include "absl/log/log.h"
@@ -15,8 +16,17 @@
 #include "utils/file_info.h"
 #include "utils/unordered_file_reader.h"
 
-template <typename T, typename R = T, typename Monoid>
-R Reduce(std::vector<FileInfo> files, Monoid monoid) {
+/**
+ * Reduce the input with a functor over contiguous blocks. The partial results of all chunks are combined with monoid.
+ *
+ * Since f is a template parameter, its loop can be inlined and auto-vectorized (or written with SIMD intrinsics),
+ * which the element-wise overload cannot offer when the loop body is the bottleneck.
+ *
+ * @param f <code>R f(const T *in, size_t n)</code> reduces a block of n elements
+ */
+template <typename T, typename R = T, typename Monoid, typename F>
+requires std::is_invocable_r_v<R, F, const T *, size_t>
+R Reduce(std::vector<FileInfo> files, Monoid monoid, F f) {
     UnorderedFileReader<T> reader;
     reader.PrepFiles(files);
     // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
@@ -28,13 +38,22 @@ R Reduce(std::vector<FileInfo> files, Monoid monoid) {
             if (n == 0) {
                 break;
             }
-            for (size_t i = 0; i < n; i++) {
-                result = monoid(result, ptr[i]);
-            }
+            result = monoid(result, f(ptr, n));
             reader.allocator.Free(ptr);
         }
         return result;
     }, 1), monoid);
 }
 
+template <typename T, typename R = T, typename Monoid>
+R Reduce(std::vector<FileInfo> files, Monoid monoid) {
+    return Reduce<T, R>(std::move(files), monoid, [&](const T *in, size_t n) {
+        R result = monoid.identity;
+        for (size_t i = 0; i < n; i++) {
+            result = monoid(result, in[i]);
+        }
+        return result;
+    });
+}
+
 #endif //SORTING_REDUCE_H
@@ -0,0 +1,140 @@
+#ifndef SORTING_SCAN_H
+#define SORTING_SCAN_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <type_traits>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "utils/file_info.h"
+#include "utils/file_utils.h"
+#include "utils/unordered_file_reader.h"
+#include "utils/unordered_file_writer.h"
+
+/**
+ * Exclusive prefix sum over a sequence computed chunk by chunk from the input. Output file i holds the prefix sums
+ * of the values computed from input file i, at the same (element) offsets.
+ *
+ * The first pass reduces every chunk. Chunk totals are then scanned in memory in the order of the input (files by
+ * position, chunks by offset), which gives the sum of everything before each chunk. The second pass re-reads every
+ * chunk, scans it starting from that sum and writes it at its offset.
+ *
+ * @tparam S Type stored in the input files
+ * @tparam T Type of the values that are scanned
+ * @param files Input files; true_size must be populated
+ * @param monoid Associative operation with an identity (e.g. parlay::plus)
+ * @param f <code>size_t f(const S *in, size_t n, size_t index, T *out)</code> computes the n values of a chunk whose
+ * first element is at global position <code>index</code> and returns n. When S and T are the same type,
+ * <code>out == in</code>.
+ * @return The sum of all values
+ */
+template<typename S, typename T, typename Monoid, typename ChunkFunction>
+T ScanChunks(const std::vector<FileInfo> &files, const std::string &result_prefix, Monoid monoid,
+             ChunkFunction f) {
+    static_assert(READER_READ_SIZE / sizeof(S) * sizeof(T) % O_DIRECT_MULTIPLE == 0, "Output chunks must be aligned");
+    // the reader reports file_index, so number the files by their position
+    auto input_files = files;
+    for (size_t i = 0; i < input_files.size(); i++) {
+        input_files[i].file_index = i;
+    }
+    ComputeBeforeSize(input_files);
+    // the reader hands out every READER_READ_SIZE bytes of real data as one chunk
+    auto chunk_start = parlay::map(input_files, [](const FileInfo &f) {
+        return (f.true_size + READER_READ_SIZE - 1) / READER_READ_SIZE;
+    });
+    size_t num_chunks = parlay::scan_inplace(chunk_start);
+    parlay::sequence<T> chunk_sums(num_chunks, monoid.identity);
+    // run f on a chunk and return the buffer holding the result
+    const auto compute = [&](S *ptr, size_t n, size_t file_index, size_t element_index) {
+        T *out;
+        if constexpr (std::is_same_v<S, T>) {
+            out = ptr;
+        } else {
+            out = (T *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, AlignUp(n * sizeof(T)));
+        }
+        size_t index = input_files[file_index].before_size / sizeof(S) + element_index;
+        CHECK(f(ptr, n, index, out) == n) << "Scan does not support chunk functions that drop elements";
+        return out;
+    };
+    {
+        UnorderedFileReader<S> reader;
+        reader.PrepFiles(input_files);
+        // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
+        reader.Start(UnorderedReaderConfig(10, 4, 8));
+        parlay::parallel_for(0, parlay::num_workers(), [&](size_t worker_index) {
+            while (true) {
+                auto [ptr, n, file_index, element_index] = reader.Poll();
+                if (ptr == nullptr) {
+                    break;
+                }
+                T *values = compute(ptr, n, file_index, element_index);
+                T sum = monoid.identity;
+                for (size_t i = 0; i < n; i++) {
+                    sum = monoid(sum, values[i]);
+                }
+                chunk_sums[chunk_start[file_index] + element_index * sizeof(S) / READER_READ_SIZE] = sum;
+                if constexpr (!std::is_same_v<S, T>) {
+                    free(values);
+                }
+                reader.allocator.Free(ptr);
+            }
+        }, 1);
+    }
+    T total = parlay::scan_inplace(chunk_sums, monoid);
+
+    UnorderedFileReader<S> reader;
+    reader.PrepFiles(input_files);
+    reader.Start(UnorderedReaderConfig(5, 16, 8));
+    UnorderedWriterConfig config;
+    config.io_uring_size = 8;
+    config.num_threads = 5;
+    config.num_files = input_files.size();
+    UnorderedFileWriter<T> writer(result_prefix, config);
+    parlay::parallel_for(0, parlay::num_workers(), [&](size_t worker_index) {
+        while (true) {
+            auto [ptr, n, file_index, element_index] = reader.Poll();
+            if (ptr == nullptr) {
+                break;
+            }
+            T *values = compute(ptr, n, file_index, element_index);
+            T sum = chunk_sums[chunk_start[file_index] + element_index * sizeof(S) / READER_READ_SIZE];
+            for (size_t i = 0; i < n; i++) {
+                T next = monoid(sum, values[i]);
+                values[i] = sum;
+                sum = next;
+            }
+            // the last chunk of a file may be partial; output buffers are always large enough to round it up
+            std::shared_ptr<T> data;
+            if constexpr (std::is_same_v<S, T>) {
+                data = std::shared_ptr<T>(values, [&](T *p) { reader.allocator.Free(p); });
+            } else {
+                data = std::shared_ptr<T>(values, free);
+                reader.allocator.Free(ptr);
+            }
+            writer.Push(data, AlignUp(n * sizeof(T)) / sizeof(T), file_index, element_index * sizeof(T));
+        }
+    }, 1);
+    writer.Wait();
+    return total;
+}
+
+/**
+ * Exclusive prefix sum over a sequence stored in multiple files. Output file i holds the prefix sums of the elements
+ * of input file i, at the same offsets.
+ *
+ * @param files Input files; true_size must be populated
+ * @param monoid Associative operation with an identity (e.g. parlay::plus)
+ * @return The sum of all elements
+ */
+template<typename T, typename Monoid>
+T Scan(const std::vector<FileInfo> &files, const std::string &result_prefix, Monoid monoid) {
+    // the values are the elements themselves, which are already in the output buffer
+    return ScanChunks<T, T>(files, result_prefix, monoid,
+                            [](const T *in, size_t n, size_t index, T *out) { return n; });
+}
+
+#endif //SORTING_SCAN_H
@@ -0,0 +1,57 @@
+#ifndef SORTING_SEMI_JOIN_H
+#define SORTING_SEMI_JOIN_H
+
+#include <vector>
+#include <string>
+
+#include "parlay/primitives.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/log/log.h"
+
+#include "utils/bloom_filter.h"
+#include "utils/file_info.h"
+#include "utils/file_utils.h"
+#include "sequence_algorithms/filter.h"
+
+/**
+ * Keep the elements whose key appears in a small set of keys, preserving their order.
+ *
+ * The keys are loaded into a hash set and a blocked Bloom filter. Every chunk of the input is probed against the
+ * filter first, which stays in cache and rejects almost every non-matching element; only the elements that pass it
+ * are looked up in the hash set. The survivors are compacted in place and written as in Filter, so non-matching data
+ * is never copied.
+ *
+ * @param files Input files; true_size must be populated
+ * @param key_files Files of Key; the keys must fit in memory. true_size must be populated.
+ * @param key <code>Key key(const T &)</code>
+ * @return One output file per input file; every file ends with an end-of-file marker
+ */
+template<typename T, typename Key, typename KeyFunction>
+std::vector<FileInfo> SemiJoin(const std::vector<FileInfo> &files, const std::vector<FileInfo> &key_files,
+                               const std::string &result_prefix, KeyFunction key) {
+    auto keys = parlay::flatten(parlay::map(key_files, [](const FileInfo &file) {
+        auto ptr = (Key *) ReadEntireFile(file.file_name, file.file_size);
+        parlay::sequence<Key> data(ptr, ptr + file.true_size / sizeof(Key));
+        free(ptr);
+        return data;
+    }));
+    BlockedBloomFilter filter(keys.size());
+    parlay::parallel_for(0, keys.size(), [&](size_t i) {
+        filter.Insert(absl::Hash<Key>()(keys[i]));
+    });
+    absl::flat_hash_set<Key> key_set(keys.begin(), keys.end());
+    LOG(INFO) << "Semi-join: " << key_set.size() << " distinct keys, " << filter.SizeInBytes() << " byte filter";
+    return Filter<T>(files, result_prefix, [&](const T *in, T *out, size_t n) {
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            Key k = key(in[i]);
+            if (filter.MayContain(absl::Hash<Key>()(k)) && key_set.contains(k)) {
+                out[count++] = in[i];
+            }
+        }
+        return count;
+    });
+}
+
+#endif //SORTING_SEMI_JOIN_H
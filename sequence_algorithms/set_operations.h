@@ -0,0 +1,221 @@
+#ifndef SORTING_SET_OPERATIONS_H
+#define SORTING_SET_OPERATIONS_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_info.h"
+#include "utils/file_utils.h"
+#include "utils/random_read.h"
+
+/**
+ * Position of the first element that is not less than each splitter (std::lower_bound) in a sorted dataset.
+ *
+ * The first element of every file is read to find the file each splitter falls in; the searches then continue within
+ * the files in lockstep, so that each step reads one element per search in a single coalesced batch.
+ *
+ * @param files Non-empty files of the dataset; true_size and before_size must be populated
+ * @param splitters Sorted splitters
+ * @return Global positions, in elements; non-decreasing
+ */
+template<typename T, typename Comparator>
+parlay::sequence<size_t> SortedLowerBounds(const std::vector<FileInfo> &files, const parlay::sequence<T> &splitters,
+                                           Comparator comp) {
+    size_t n = 0;
+    for (const auto &f: files) {
+        n += f.true_size / sizeof(T);
+    }
+    if (n == 0) {
+        return parlay::sequence<size_t>(splitters.size(), 0);
+    }
+    auto file_starts = parlay::map(files, [](const FileInfo &f) { return f.before_size / sizeof(T); });
+    auto file_firsts = RandomBatchReadCoalesced<T>(files, file_starts);
+    // the answer is in [lo, hi]: after the last file whose first element is less than the splitter, or at its start
+    parlay::sequence<size_t> lo(splitters.size()), hi(splitters.size());
+    parlay::parallel_for(0, splitters.size(), [&](size_t i) {
+        size_t file = std::lower_bound(file_firsts.begin(), file_firsts.end(), splitters[i], comp)
+                      - file_firsts.begin();
+        if (file == 0) {
+            lo[i] = hi[i] = 0;
+        } else {
+            lo[i] = file_starts[file - 1] + 1;
+            hi[i] = file == files.size() ? n : file_starts[file];
+        }
+    });
+    while (true) {
+        auto active = parlay::filter(parlay::iota(splitters.size()), [&](size_t i) { return lo[i] < hi[i]; });
+        if (active.empty()) {
+            break;
+        }
+        auto mid = parlay::map(active, [&](size_t i) { return lo[i] + (hi[i] - lo[i]) / 2; });
+        auto values = RandomBatchReadCoalesced<T>(files, mid);
+        parlay::parallel_for(0, active.size(), [&](size_t j) {
+            size_t i = active[j];
+            if (comp(values[j], splitters[i])) {
+                lo[i] = mid[j] + 1;
+            } else {
+                hi[i] = mid[j];
+            }
+        });
+    }
+    return lo;
+}
+
+/**
+ * Combine two sorted datasets with a merge-like operation.
+ *
+ * Splitters are taken at evenly spaced positions of both inputs, and the run of elements equal to each splitter is
+ * located in both inputs by binary search. This cuts the inputs into aligned key ranges that can be processed
+ * independently. A run longer than a range is cut further at equal offsets from its start on both sides, which keeps
+ * the multiset semantics of the merge since equal elements are paired up by rank. Ranges are sized so that every worker
+ * can hold one in memory; they are read and merged in parallel, and range i is written to output file i. The global
+ * offset of each range is the prefix sum of the output sizes before it (see ComputeBeforeSize).
+ *
+ * @param max_output <code>size_t max_output(size_t na, size_t nb)</code> bounds the output size of a range
+ * @param merge <code>T *merge(const T *a, size_t na, const T *b, size_t nb, T *out)</code> writes the result of a
+ * range to out and returns its end
+ * @return One file per range, in order; every file ends with an end-of-file marker
+ */
+template<typename T, typename Comparator, typename MaxOutput, typename Merge>
+std::vector<FileInfo> SortedSetOperation(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+                                         const std::string &result_prefix, Comparator comp,
+                                         MaxOutput max_output, Merge merge) {
+    parlay::internal::timer timer("Sorted set operation", true);
+    // RandomBatchRead cannot address empty files
+    std::vector<FileInfo> a_input, b_input;
+    std::copy_if(a_files.begin(), a_files.end(), std::back_inserter(a_input), [](auto &f) { return f.true_size > 0; });
+    std::copy_if(b_files.begin(), b_files.end(), std::back_inserter(b_input), [](auto &f) { return f.true_size > 0; });
+    ComputeBeforeSize(a_input);
+    ComputeBeforeSize(b_input);
+    size_t na = 0, nb = 0;
+    for (const auto &f: a_input) {
+        na += f.true_size / sizeof(T);
+    }
+    for (const auto &f: b_input) {
+        nb += f.true_size / sizeof(T);
+    }
+    // a range and its output must fit in a worker's share of half the memory
+    const size_t range_size = std::max(2UL, MAIN_MEMORY_SIZE / 4 / parlay::num_workers() / sizeof(T));
+    const size_t splitters_per_side = std::max(4 * parlay::num_workers(), (na + nb + range_size - 1) / range_size);
+    parlay::sequence<size_t> a_positions, b_positions;
+    for (size_t i = 1; i < splitters_per_side; i++) {
+        if (na > 0) {
+            a_positions.push_back(i * na / splitters_per_side);
+        }
+        if (nb > 0) {
+            b_positions.push_back(i * nb / splitters_per_side);
+        }
+    }
+    auto splitters = parlay::sort(parlay::append(RandomBatchReadCoalesced<T>(a_input, a_positions),
+                                                 RandomBatchReadCoalesced<T>(b_input, b_positions)), comp);
+    splitters.erase(std::unique(splitters.begin(), splitters.end(), [&](const T &x, const T &y) {
+        return !comp(x, y) && !comp(y, x);
+    }), splitters.end());
+    // each splitter starts a run of equal elements on both sides, which no sample bounds; everything else between two
+    // splitters is at most a sample interval long
+    const auto not_greater = [&](const T &x, const T &splitter) { return !comp(splitter, x); };
+    auto a_lower = SortedLowerBounds(a_input, splitters, comp);
+    auto a_upper = SortedLowerBounds(a_input, splitters, not_greater);
+    auto b_lower = SortedLowerBounds(b_input, splitters, comp);
+    auto b_upper = SortedLowerBounds(b_input, splitters, not_greater);
+    // Pieces of the inputs: [a_begin, a_end) and [b_begin, b_end). A run is cut at the same offsets from its start on
+    // both sides; the merge operations pair up equal elements by their rank within the run, so the pieces of a run can
+    // be merged separately.
+    struct Piece {
+        size_t a_begin, a_end, b_begin, b_end;
+    };
+    std::vector<Piece> pieces;
+    size_t a_start = 0, b_start = 0;
+    for (size_t i = 0; i <= splitters.size(); i++) {
+        size_t a_stop = i == splitters.size() ? na : a_lower[i], b_stop = i == splitters.size() ? nb : b_lower[i];
+        if (a_start < a_stop || b_start < b_stop) {
+            pieces.push_back({a_start, a_stop, b_start, b_stop});
+        }
+        if (i == splitters.size()) {
+            break;
+        }
+        size_t a_run = a_upper[i] - a_stop, b_run = b_upper[i] - b_stop;
+        for (size_t offset = 0; offset < std::max(a_run, b_run); offset += range_size / 2) {
+            size_t end = offset + range_size / 2;
+            pieces.push_back({a_stop + std::min(offset, a_run), a_stop + std::min(end, a_run),
+                              b_stop + std::min(offset, b_run), b_stop + std::min(end, b_run)});
+        }
+        a_start = a_upper[i];
+        b_start = b_upper[i];
+    }
+    size_t num_ranges = pieces.size();
+    timer.next("Inputs split into " + std::to_string(num_ranges) + " ranges");
+
+    std::vector<FileInfo> results(num_ranges);
+    parlay::parallel_for(0, num_ranges, [&](size_t r) {
+        const Piece &piece = pieces[r];
+        size_t a_size = piece.a_end - piece.a_begin, b_size = piece.b_end - piece.b_begin;
+        unsigned char *a, *b;
+        void *a_buffer = ReadFileRangeInPlace(a_input, piece.a_begin * sizeof(T), a_size * sizeof(T), &a);
+        void *b_buffer = ReadFileRangeInPlace(b_input, piece.b_begin * sizeof(T), b_size * sizeof(T), &b);
+        auto *out = (T *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT,
+                                             AlignUp(max_output(a_size, b_size) * sizeof(T) + METADATA_SIZE));
+        size_t true_size = (merge((const T *) a, a_size, (const T *) b, b_size, out) - out) * sizeof(T);
+        free(a_buffer);
+        free(b_buffer);
+        std::string target_file = GetFileName(result_prefix, r);
+        size_t file_size = WriteFileWithEndMarker(target_file, out, true_size);
+        free(out);
+        results[r] = {target_file, r, true_size, file_size};
+    }, 1);
+    ComputeBeforeSize(results);
+    timer.next("Ranges merged");
+    timer.stop();
+    return results;
+}
+
+/**
+ * Elements of a that are also in b, with multiset semantics (std::set_intersection)
+ *
+ * @param a_files, b_files Files of datasets sorted by comp (e.g. output of SampleSort); true_size must be populated
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<FileInfo> SortedIntersect(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+                                      const std::string &result_prefix, Comparator comp = {}) {
+    return SortedSetOperation<T>(a_files, b_files, result_prefix, comp, [](size_t na, size_t nb) {
+        return std::min(na, nb);
+    }, [&](const T *a, size_t na, const T *b, size_t nb, T *out) {
+        return std::set_intersection(a, a + na, b, b + nb, out, comp);
+    });
+}
+
+/**
+ * Elements that are in a or b, with multiset semantics (std::set_union)
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<FileInfo> SortedUnion(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+                                  const std::string &result_prefix, Comparator comp = {}) {
+    return SortedSetOperation<T>(a_files, b_files, result_prefix, comp, [](size_t na, size_t nb) {
+        return na + nb;
+    }, [&](const T *a, size_t na, const T *b, size_t nb, T *out) {
+        return std::set_union(a, a + na, b, b + nb, out, comp);
+    });
+}
+
+/**
+ * Elements of a that are not in b, with multiset semantics (std::set_difference)
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<FileInfo> SortedDifference(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+                                       const std::string &result_prefix, Comparator comp = {}) {
+    return SortedSetOperation<T>(a_files, b_files, result_prefix, comp, [](size_t na, size_t nb) {
+        return na;
+    }, [&](const T *a, size_t na, const T *b, size_t nb, T *out) {
+        return std::set_difference(a, a + na, b, b + nb, out, comp);
+    });
+}
+
+#endif //SORTING_SET_OPERATIONS_H
@@ -0,0 +1,96 @@
+#ifndef SORTING_TOP_K_H
+#define SORTING_TOP_K_H
+
+#include <vector>
+#include <algorithm>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_info.h"
+#include "utils/unordered_file_reader.h"
+
+/**
+ * Find the k largest elements according to comp without sorting the input.
+ *
+ * Every worker keeps a buffer of candidates. Elements are appended to it without branching when they beat the
+ * worker's current k-th largest candidate, so for small k almost every element costs a single comparison. When the
+ * buffer holds 2k candidates, it is cut back to the best k and the threshold is raised. The buffers of all workers
+ * are merged at the end.
+ *
+ * @param comp Strict weak ordering (less than)
+ * @return The min(k, n) largest elements, largest first
+ */
+template<typename T, typename Comparator>
+std::vector<T> TopK(const std::vector<FileInfo> &files, size_t k, Comparator comp) {
+    if (k == 0) {
+        return {};
+    }
+    CHECK(2 * k * sizeof(T) * parlay::num_workers() <= MAIN_MEMORY_SIZE)
+        << "k = " << k << " is too large to keep the candidates of every worker in memory";
+    const auto greater = [&](const T &a, const T &b) {
+        return comp(b, a);
+    };
+    UnorderedFileReader<T> reader;
+    reader.PrepFiles(files);
+    // Use more IO threads to maximize bandwidth since this is the bottleneck, not the CPU
+    reader.Start(UnorderedReaderConfig(10, 4, 8));
+    auto candidates = parlay::tabulate(parlay::num_workers(), [&](size_t worker_index) {
+        std::vector<T> buffer;
+        size_t size = 0;
+        bool has_threshold = false;
+        T threshold{};
+        while (true) {
+            auto [ptr, n, _, _2] = reader.Poll();
+            if (n == 0) {
+                break;
+            }
+            buffer.resize(size + n);
+            T *out = buffer.data();
+            if (has_threshold) {
+                for (size_t i = 0; i < n; i++) {
+                    out[size] = ptr[i];
+                    size += comp(threshold, ptr[i]);
+                }
+            } else {
+                std::copy(ptr, ptr + n, out + size);
+                size += n;
+            }
+            reader.allocator.Free(ptr);
+            if (size >= 2 * k) {
+                std::nth_element(buffer.begin(), buffer.begin() + (long) k - 1, buffer.begin() + (long) size, greater);
+                size = k;
+                threshold = buffer[k - 1];
+                has_threshold = true;
+            }
+        }
+        buffer.resize(size);
+        return buffer;
+    }, 1);
+    auto result = parlay::flatten(candidates);
+    // the input may be empty, in which case there is no k-th element to partition around
+    if (result.empty()) {
+        return {};
+    }
+    k = std::min(k, result.size());
+    std::nth_element(result.begin(), result.begin() + (long) k - 1, result.end(), greater);
+    result.resize(k);
+    parlay::sort_inplace(result, greater);
+    return {result.begin(), result.end()};
+}
+
+/**
+ * Find the k smallest elements according to comp without sorting the input.
+ *
+ * @return The min(k, n) smallest elements, smallest first
+ */
+template<typename T, typename Comparator>
+std::vector<T> BottomK(const std::vector<FileInfo> &files, size_t k, Comparator comp) {
+    return TopK<T>(files, k, [&](const T &a, const T &b) {
+        return comp(b, a);
+    });
+}
+
+#endif //SORTING_TOP_K_H
@@ -0,0 +1,139 @@
+#ifndef SORTING_ZIP_WITH_H
+#define SORTING_ZIP_WITH_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <type_traits>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_info.h"
+#include "utils/unordered_file_reader.h"
+#include "utils/unordered_file_writer.h"
+
+/**
+ * Combine two datasets with the same logical layout element by element: output file i holds f(a[j], b[j]) for every
+ * element j of input file i, at the same (element) offsets.
+ *
+ * Each dataset is read by its own UnorderedFileReader. The reader of b uses a chunk size that covers the same elements
+ * as a chunk of a, so chunk c of file i of both datasets covers the same global index range and chunks are paired by
+ * (file, chunk). Since both readers deliver chunks in no particular order, the datasets are read in rounds that
+ * activate a window of chunks of every file (see UnorderedReaderConfig::active_chunks_per_file). Both readers run
+ * concurrently; the chunks of a are collected first, then each chunk of b is combined with its partner as soon as it
+ * arrives. The window bounds the number of chunks held in memory.
+ *
+ * @param a_files, b_files Input files; true_size must be populated, and file i of both datasets must hold the same
+ * number of elements
+ * @param f <code>void f(const A *a, const B *b, R *out, size_t n)</code>. When A and R have the same size, the output
+ * is written in place and <code>out == a</code>.
+ */
+template<typename A, typename B, typename R, typename F>
+requires std::is_invocable_v<F, const A *, const B *, R *, size_t>
+void ZipWith(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+             const std::string &result_prefix, F f) {
+    constexpr size_t CHUNK_ELEMENTS = READER_READ_SIZE / sizeof(A);
+    constexpr size_t B_READ_SIZE = CHUNK_ELEMENTS * sizeof(B);
+    static_assert(READER_READ_SIZE % sizeof(A) == 0, "Chunks must hold whole elements");
+    static_assert(B_READ_SIZE % O_DIRECT_MULTIPLE == 0 && CHUNK_ELEMENTS * sizeof(R) % O_DIRECT_MULTIPLE == 0,
+                  "Chunks of the other datasets must be aligned");
+    constexpr bool in_place = sizeof(A) == sizeof(R);
+    CHECK(a_files.size() == b_files.size()) << "Datasets have " << a_files.size() << " and " << b_files.size()
+                                            << " files";
+    // the readers report file_index, so number the files by their position
+    auto a_input = a_files, b_input = b_files;
+    size_t max_chunks = 0;
+    for (size_t i = 0; i < a_input.size(); i++) {
+        CHECK(a_input[i].true_size / sizeof(A) == b_input[i].true_size / sizeof(B))
+            << "File " << i << " holds " << a_input[i].true_size / sizeof(A) << " and "
+            << b_input[i].true_size / sizeof(B) << " elements";
+        a_input[i].file_index = i;
+        b_input[i].file_index = i;
+        max_chunks = std::max(max_chunks, (a_input[i].true_size + READER_READ_SIZE - 1) / READER_READ_SIZE);
+    }
+    // chunks of a that wait for their partner: at most a quarter of the memory
+    const size_t window = std::max(1UL, MAIN_MEMORY_SIZE / 4 / READER_READ_SIZE / std::max(1UL, a_input.size()));
+    std::vector<std::vector<A *>> pending(a_input.size(), std::vector<A *>(window, nullptr));
+
+    UnorderedFileReader<A> a_reader;
+    UnorderedFileReader<B, B_READ_SIZE> b_reader;
+    a_reader.PrepFiles(a_input);
+    b_reader.PrepFiles(b_input);
+    UnorderedWriterConfig config;
+    config.io_uring_size = 8;
+    config.num_threads = 5;
+    config.num_files = a_input.size();
+    UnorderedFileWriter<R> writer(result_prefix, config);
+    for (size_t round_start = 0; round_start < max_chunks; round_start += window) {
+        std::vector<std::vector<uint64_t>> active(a_input.size(), std::vector<uint64_t>((max_chunks + 63) / 64, 0));
+        for (auto &bits: active) {
+            for (size_t c = round_start; c < std::min(round_start + window, max_chunks); c++) {
+                bits[c / 64] |= 1UL << (c % 64);
+            }
+        }
+        UnorderedReaderConfig reader_config(5, 16, 8);
+        reader_config.active_chunks_per_file = &active;
+        a_reader.Start(reader_config);
+        b_reader.Start(reader_config);
+        // a chunk of b may only be combined once every chunk of a in the round is in place
+        parlay::parallel_for(0, parlay::num_workers(), [&](size_t _) {
+            while (true) {
+                auto [ptr, n, file_index, element_index] = a_reader.Poll();
+                if (ptr == nullptr) {
+                    break;
+                }
+                pending[file_index][element_index / CHUNK_ELEMENTS - round_start] = ptr;
+            }
+        }, 1);
+        parlay::parallel_for(0, parlay::num_workers(), [&](size_t _) {
+            while (true) {
+                auto [ptr, n, file_index, element_index] = b_reader.Poll();
+                if (ptr == nullptr) {
+                    break;
+                }
+                A *a = pending[file_index][element_index / CHUNK_ELEMENTS - round_start];
+                CHECK(a != nullptr) << "Chunk " << element_index / CHUNK_ELEMENTS << " of file " << file_index
+                                    << " is missing from the first dataset";
+                std::shared_ptr<R> result;
+                if constexpr (in_place) {
+                    // FIXME: strict aliasing violation here?
+                    f(a, ptr, (R *) a, n);
+                    result = std::shared_ptr<R>((R *) a, [&](R *p) { a_reader.allocator.Free((A *) p); });
+                } else {
+                    result = std::shared_ptr<R>((R *) aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT,
+                                                                    AlignUp(n * sizeof(R))), free);
+                    f(a, ptr, result.get(), n);
+                    a_reader.allocator.Free(a);
+                }
+                b_reader.allocator.Free(ptr);
+                // the last chunk of a file may be partial; output buffers are always large enough to round it up
+                writer.Push(result, AlignUp(n * sizeof(R)) / sizeof(R), file_index, element_index * sizeof(R));
+            }
+        }, 1);
+        a_reader.Reset();
+        b_reader.Reset();
+        for (auto &chunks: pending) {
+            std::fill(chunks.begin(), chunks.end(), nullptr);
+        }
+    }
+    writer.Wait();
+}
+
+/**
+ * Element-wise version of ZipWith: output element j is <code>f(a[j], b[j])</code>
+ */
+template<typename A, typename B, typename R, typename F>
+requires std::is_invocable_r_v<R, F, const A &, const B &>
+void ZipWith(const std::vector<FileInfo> &a_files, const std::vector<FileInfo> &b_files,
+             const std::string &result_prefix, F f) {
+    ZipWith<A, B, R>(a_files, b_files, result_prefix, [&](const A *a, const B *b, R *out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = f(a[i], b[i]);
+        }
+    });
+}
+
+#endif //SORTING_ZIP_WITH_H
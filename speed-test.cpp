@@ -75,6 +75,9 @@ std::map<std::string, std::function<void(int, char **)>> test_functions = {
         {"read_only",             UnorderedReadTest},
         {"ordered_writer",        OrderedFileWriterTest},
         {"rand_read",             RandomReadTest},
+        {"range_read",            RangeReadTest},
+        {"lookup_service",        LookupServiceTest},
+        {"block_cache",           BlockCacheTest},
         {"large_read",            LargeReadTest},
         // In-memory algorithms
         {"sorting_in_memory",     InMemorySortingTest},
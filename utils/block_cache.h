@@ -0,0 +1,338 @@
+#ifndef SORTING_BLOCK_CACHE_H
+#define SORTING_BLOCK_CACHE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <algorithm>
+
+#include "parlay/primitives.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/random_read.h"
+
+/**
+ * A user-space cache of aligned blocks for batches of random element reads, which are otherwise O_DIRECT and always go
+ * to the SSDs. Meant for skewed lookups, where a small cache absorbs most of the traffic.
+ *
+ * Blocks are keyed by file and block number and spread over shards by hash; each shard is a fixed set of slots with its
+ * own lock and a CLOCK hand, so the cache never holds more than its byte budget. A batch first copies what it can from
+ * the cache, then claims the missing blocks and reads them together through RandomBatchReadRanges. A block that
+ * another batch is reading is not read again: the batch waits for it instead.
+ *
+ * Files are identified by name, so a file must not change while its blocks are cached (see Clear).
+ */
+class BlockCache {
+public:
+    static constexpr size_t BLOCK_SIZE = O_DIRECT_MULTIPLE;
+
+    struct Stats {
+        // elements (or parts of elements that span blocks) requested
+        size_t lookups = 0;
+        // lookups served from the cache, including those that waited for another batch to read their block
+        size_t hits = 0;
+        // blocks read from the SSDs
+        size_t block_reads = 0;
+        size_t evictions = 0;
+
+        [[nodiscard]] double HitRate() const {
+            return lookups == 0 ? 0 : (double) hits / (double) lookups;
+        }
+    };
+
+    /**
+     * @param capacity Byte budget for cached blocks
+     */
+    explicit BlockCache(size_t capacity, size_t num_shards = 64) {
+        size_t num_blocks = std::max(1UL, capacity / BLOCK_SIZE);
+        num_shards = std::clamp(num_shards, 1UL, num_blocks);
+        for (size_t i = 0; i < num_shards; i++) {
+            shards.push_back(std::make_unique<Shard>(num_blocks * (i + 1) / num_shards - num_blocks * i / num_shards));
+        }
+    }
+
+    BlockCache(const BlockCache &) = delete;
+
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    /**
+     * Read the elements at the given positions of a dataset, like RandomBatchRead
+     *
+     * @param files Files of the dataset; true_size must be populated
+     * @return The element at each requested position, in the order of the requests
+     */
+    template<typename T>
+    parlay::sequence<T> Read(const std::vector<FileInfo> &files, const parlay::sequence<size_t> &requests) {
+        std::vector<size_t> size_prefix_sum(files.size()), file_ids(files.size());
+        for (size_t i = 0; i < files.size(); i++) {
+            size_prefix_sum[i] = files[i].true_size + (i == 0 ? 0 : size_prefix_sum[i - 1]);
+            file_ids[i] = GetFileId(files[i].file_name);
+        }
+        // an element that spans blocks needs a piece from each of them
+        const auto split = [&](size_t r, auto emit) {
+            size_t byte_offset = requests[r] * sizeof(T);
+            size_t file_num = std::upper_bound(size_prefix_sum.begin(), size_prefix_sum.end(), byte_offset)
+                              - size_prefix_sum.begin();
+            CHECK(file_num < files.size()) << "Position " << requests[r] << " is out of bounds";
+            size_t file_offset = file_num == 0 ? byte_offset : byte_offset - size_prefix_sum[file_num - 1];
+            for (size_t done = 0; done < sizeof(T);) {
+                size_t block = (file_offset + done) / BLOCK_SIZE, offset = (file_offset + done) % BLOCK_SIZE;
+                size_t length = std::min(sizeof(T) - done, BLOCK_SIZE - offset);
+                emit(Piece{{file_ids[file_num], block}, file_num, r * sizeof(T) + done, offset, length});
+                done += length;
+            }
+        };
+        auto piece_offsets = parlay::scan(parlay::map(parlay::iota(requests.size()), [&](size_t r) {
+            size_t count = 0;
+            split(r, [&](const Piece &) { count++; });
+            return count;
+        }));
+        auto pieces = parlay::sequence<Piece>::uninitialized(piece_offsets.second);
+        parlay::parallel_for(0, requests.size(), [&](size_t r) {
+            size_t next = piece_offsets.first[r];
+            split(r, [&](const Piece &piece) { pieces[next++] = piece; });
+        });
+        lookups += pieces.size();
+
+        auto results = parlay::sequence<T>::uninitialized(requests.size());
+        auto *output = (unsigned char *) results.data();
+        auto pending = parlay::iota(pieces.size());
+        // a round serves the pieces whose blocks it reads; it only leaves those that another batch was reading
+        while (!pending.empty()) {
+            size_t num_pending = pending.size();
+            pending = parlay::filter(pending, [&](size_t p) {
+                return !GetShard(pieces[p].key).TryCopy(pieces[p], output);
+            });
+            hits += num_pending - pending.size();
+            // one piece per missing block, in block order
+            auto by_block = parlay::sort(pending, [&](size_t a, size_t b) { return pieces[a].key < pieces[b].key; });
+            auto missing = parlay::map(parlay::filter(parlay::iota(by_block.size()), [&](size_t j) {
+                return j == 0 || !(pieces[by_block[j - 1]].key == pieces[by_block[j]].key);
+            }), [&](size_t j) { return pieces[by_block[j]]; });
+            const auto find_block = [&](const BlockKey &key) {
+                return std::lower_bound(missing.begin(), missing.end(), key, [](const Piece &piece, const BlockKey &k) {
+                    return piece.key < k;
+                }) - missing.begin();
+            };
+            const auto block_length = [&](size_t i) {
+                return std::min(BLOCK_SIZE, files[missing[i].file_num].true_size - missing[i].key.block * BLOCK_SIZE);
+            };
+            auto slots = parlay::map(missing, [&](const Piece &piece) { return GetShard(piece.key).Claim(piece.key); });
+            auto to_read = parlay::filter(parlay::iota(missing.size()), [&](size_t i) { return slots[i] != OTHER; });
+            auto read_offsets = parlay::scan(parlay::map(to_read, block_length)).first;
+            auto buffer = parlay::sequence<unsigned char>::uninitialized(to_read.size() * BLOCK_SIZE);
+            RandomBatchReadRanges(files, parlay::map(to_read, [&](size_t i) {
+                size_t file_num = missing[i].file_num;
+                size_t file_start = file_num == 0 ? 0 : size_prefix_sum[file_num - 1];
+                return std::make_pair(file_start + missing[i].key.block * BLOCK_SIZE, block_length(i));
+            }), buffer.data());
+            block_reads += to_read.size();
+            parlay::parallel_for(0, to_read.size(), [&](size_t j) {
+                size_t i = to_read[j];
+                if (slots[i] != UNCACHED) {
+                    GetShard(missing[i].key).Fill(slots[i], buffer.data() + read_offsets[j], block_length(i));
+                }
+            });
+            // serve the pieces of the blocks just read from the buffer, so that eviction cannot starve the batch
+            pending = parlay::filter(pending, [&](size_t p) {
+                const Piece &piece = pieces[p];
+                size_t i = find_block(piece.key);
+                if (slots[i] == OTHER) {
+                    return true;
+                }
+                size_t j = std::lower_bound(to_read.begin(), to_read.end(), i) - to_read.begin();
+                memcpy(output + piece.output_offset, buffer.data() + read_offsets[j] + piece.block_offset,
+                       piece.length);
+                return false;
+            });
+            // the remaining pieces are in blocks that other batches are reading
+            parlay::parallel_for(0, missing.size(), [&](size_t i) {
+                if (slots[i] == OTHER) {
+                    GetShard(missing[i].key).WaitUntilLoaded(missing[i].key);
+                }
+            });
+        }
+        return results;
+    }
+
+    /**
+     * Drop all cached blocks, e.g. after files were rewritten
+     */
+    void Clear() {
+        for (auto &shard: shards) {
+            shard->Clear();
+        }
+    }
+
+    [[nodiscard]] Stats GetStats() const {
+        Stats stats;
+        stats.lookups = lookups;
+        stats.hits = hits;
+        stats.block_reads = block_reads;
+        for (const auto &shard: shards) {
+            stats.evictions += shard->evictions;
+        }
+        return stats;
+    }
+
+    void ResetStats() {
+        lookups = hits = block_reads = 0;
+        for (auto &shard: shards) {
+            shard->evictions = 0;
+        }
+    }
+
+private:
+    struct BlockKey {
+        size_t file_id;
+        size_t block;
+
+        bool operator==(const BlockKey &other) const {
+            return file_id == other.file_id && block == other.block;
+        }
+
+        bool operator<(const BlockKey &other) const {
+            return file_id < other.file_id || (file_id == other.file_id && block < other.block);
+        }
+
+        template<typename H>
+        friend H AbslHashValue(H h, const BlockKey &key) {
+            return H::combine(std::move(h), key.file_id, key.block);
+        }
+    };
+
+    struct Piece {
+        BlockKey key;
+        size_t file_num;
+        // bytes from the start of the results
+        size_t output_offset;
+        size_t block_offset;
+        size_t length;
+    };
+
+    // results of Claim other than a slot
+    static constexpr size_t OTHER = SIZE_MAX;
+    static constexpr size_t UNCACHED = SIZE_MAX - 1;
+
+    struct Slot {
+        BlockKey key;
+        bool valid = false;
+        bool loading = false;
+        // CLOCK reference bit; set on every hit
+        bool referenced = false;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::condition_variable loaded;
+        absl::flat_hash_map<BlockKey, size_t> table;
+        std::vector<Slot> slots;
+        unsigned char *data;
+        size_t hand = 0;
+        std::atomic<size_t> evictions = 0;
+
+        explicit Shard(size_t num_slots) : slots(num_slots) {
+            data = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, num_slots * BLOCK_SIZE);
+        }
+
+        ~Shard() {
+            free(data);
+        }
+
+        bool TryCopy(const Piece &piece, unsigned char *output) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = table.find(piece.key);
+            if (it == table.end() || slots[it->second].loading) {
+                return false;
+            }
+            slots[it->second].referenced = true;
+            memcpy(output + piece.output_offset, data + it->second * BLOCK_SIZE + piece.block_offset, piece.length);
+            return true;
+        }
+
+        /**
+         * Reserve a slot for a block that the caller is about to read
+         *
+         * @return The slot; UNCACHED if every slot is being loaded; OTHER if the block is cached or being read already
+         */
+        size_t Claim(const BlockKey &key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (table.contains(key)) {
+                return OTHER;
+            }
+            // CLOCK: give referenced blocks a second chance; two sweeps clear every reference bit
+            for (size_t step = 0; step < 2 * slots.size(); step++) {
+                Slot &slot = slots[hand];
+                size_t index = hand;
+                hand = (hand + 1) % slots.size();
+                if (slot.loading) {
+                    continue;
+                }
+                if (slot.valid && slot.referenced) {
+                    slot.referenced = false;
+                    continue;
+                }
+                if (slot.valid) {
+                    table.erase(slot.key);
+                    evictions++;
+                }
+                slot = {key, true, true, false};
+                table[key] = index;
+                return index;
+            }
+            return UNCACHED;
+        }
+
+        void Fill(size_t index, const unsigned char *block, size_t length) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                memcpy(data + index * BLOCK_SIZE, block, length);
+                slots[index].loading = false;
+            }
+            loaded.notify_all();
+        }
+
+        void WaitUntilLoaded(const BlockKey &key) {
+            std::unique_lock<std::mutex> lock(mutex);
+            loaded.wait(lock, [&]() {
+                auto it = table.find(key);
+                return it == table.end() || !slots[it->second].loading;
+            });
+        }
+
+        void Clear() {
+            std::unique_lock<std::mutex> lock(mutex);
+            // blocks that are being loaded belong to running batches
+            loaded.wait(lock, [&]() {
+                return std::none_of(slots.begin(), slots.end(), [](const Slot &slot) { return slot.loading; });
+            });
+            table.clear();
+            std::fill(slots.begin(), slots.end(), Slot());
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::mutex file_ids_mutex;
+    absl::flat_hash_map<std::string, size_t> file_ids;
+    std::atomic<size_t> lookups = 0, hits = 0, block_reads = 0;
+
+    size_t GetFileId(const std::string &file_name) {
+        std::lock_guard<std::mutex> lock(file_ids_mutex);
+        return file_ids.try_emplace(file_name, file_ids.size()).first->second;
+    }
+
+    Shard &GetShard(const BlockKey &key) {
+        // the tables use the low bits of the same hash; the shard is chosen by the high bits
+        return *shards[(absl::Hash<BlockKey>()(key) >> 32) % shards.size()];
+    }
+};
+
+#endif //SORTING_BLOCK_CACHE_H
@@ -0,0 +1,82 @@
+#ifndef SORTING_BLOOM_FILTER_H
+#define SORTING_BLOOM_FILTER_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * A blocked Bloom filter: every key sets one bit in each of the 8 words of a single 64-byte block, so a lookup touches
+ * one cache line. The 8 masks and the membership test are plain loops over the words of the block, which the compiler
+ * turns into a few SIMD shifts and compares (with -march=native).
+ *
+ * Keys are given as 64-bit hashes. Insert may be called concurrently; lookups must not overlap with inserts.
+ */
+class BlockedBloomFilter {
+public:
+    /**
+     * @param num_keys Expected number of keys
+     * @param bits_per_key About 1% of absent keys pass at 12 bits per key, and about 0.2% at 16
+     */
+    explicit BlockedBloomFilter(size_t num_keys, size_t bits_per_key = 16)
+            : num_blocks(std::max(1UL, num_keys * bits_per_key / BLOCK_BITS)), blocks(num_blocks) {}
+
+    void Insert(uint64_t hash) {
+        uint64_t masks[WORDS_PER_BLOCK];
+        GetMasks(hash, masks);
+        Block &block = blocks[GetBlock(hash)];
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            // skip the atomic when the bit is already set, which is common for duplicate keys
+            if ((block.words[i] & masks[i]) != masks[i]) {
+                std::atomic_ref<uint64_t>(block.words[i]).fetch_or(masks[i], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @return false if the key was definitely not inserted
+     */
+    [[nodiscard]] bool MayContain(uint64_t hash) const {
+        uint64_t masks[WORDS_PER_BLOCK];
+        GetMasks(hash, masks);
+        const Block &block = blocks[GetBlock(hash)];
+        uint64_t missing = 0;
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            missing |= masks[i] & ~block.words[i];
+        }
+        return missing == 0;
+    }
+
+    [[nodiscard]] size_t SizeInBytes() const {
+        return num_blocks * sizeof(Block);
+    }
+
+private:
+    static constexpr size_t WORDS_PER_BLOCK = 8;
+    static constexpr size_t BLOCK_BITS = WORDS_PER_BLOCK * 64;
+
+    struct alignas(64) Block {
+        uint64_t words[WORDS_PER_BLOCK] = {};
+    };
+
+    size_t num_blocks;
+    std::vector<Block> blocks;
+
+    size_t GetBlock(uint64_t hash) const {
+        return (size_t) (((unsigned __int128) hash * num_blocks) >> 64);
+    }
+
+    /**
+     * One bit per word, taken from a remix of the hash so that it is independent of the choice of block
+     */
+    static void GetMasks(uint64_t hash, uint64_t *masks) {
+        uint64_t bits = hash * 0x9e3779b97f4a7c15UL;
+        bits ^= bits >> 29;
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            masks[i] = 1UL << ((bits >> (6 * i)) & 63);
+        }
+    }
+};
+
+#endif //SORTING_BLOOM_FILTER_H
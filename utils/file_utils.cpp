@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <set>
 #include <random>
+#include <algorithm>
 
 #include "parlay/parallel.h"
 
@@ -70,7 +71,7 @@ void GetFileInfo(std::vector<FileInfo> &info, bool eof_marker, bool compute_befo
                 ReadFileOnce(info[i].file_name, buffer, info[i].file_size - O_DIRECT_MULTIPLE);
                 info[i].true_size = info[i].file_size - *(uint16_t *) (buffer + O_DIRECT_MULTIPLE - METADATA_SIZE);
             }
-        } else {
+        } else if (info[i].true_size == 0) {
             info[i].true_size = info[i].file_size;
         }
     }, 1);
@@ -217,6 +218,133 @@ void *ReadEntireFile(const std::string &file_name, size_t read_size) {
     return buffer;
 }
 
+/**
+ * Read the aligned span [aligned_start, aligned_start + aligned_size) of an open O_DIRECT file, which may extend past
+ * the end of the file
+ *
+ * @return Number of bytes read
+ */
+static size_t ReadAlignedSpan(int fd, size_t aligned_start, size_t aligned_size, unsigned char *buffer) {
+    size_t result_size = 0;
+    while (result_size < aligned_size) {
+        auto cur_size = pread(fd, buffer + result_size, aligned_size - result_size,
+                              (off_t) (aligned_start + result_size));
+        SYSCALL(cur_size);
+        if (cur_size == 0) {
+            break;
+        }
+        result_size += cur_size;
+    }
+    return result_size;
+}
+
+/**
+ * Read size bytes starting at the unaligned offset file_start of an open O_DIRECT file
+ */
+static void ReadUnalignedRange(int fd, const std::string &file_name, size_t file_start, size_t size, void *buffer) {
+    size_t aligned_start = AlignDown(file_start);
+    size_t aligned_size = AlignUp(file_start + size) - aligned_start;
+    auto temp = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, aligned_size);
+    size_t result_size = ReadAlignedSpan(fd, aligned_start, aligned_size, temp);
+    CHECK(result_size >= file_start - aligned_start + size) << "Short read from " << file_name;
+    memcpy(buffer, temp + (file_start - aligned_start), size);
+    free(temp);
+}
+
+/**
+ * Read a byte range of a dataset that spans multiple files, treating the files as one contiguous array.
+ * Neither start nor read_size needs to be aligned.
+ *
+ * @param files Files of the dataset; true_size and before_size must be populated (see GetFileInfo)
+ * @param fds If not empty, descriptors of the files opened with O_DIRECT, in the same order; otherwise every file
+ * that is touched is opened and closed again
+ * @param start Byte offset into the dataset
+ * @param read_size Number of bytes to read; the range must not go past the end of the dataset
+ * @param buffer Buffer to which the result will be written
+ */
+void ReadFileRange(const std::vector<FileInfo> &files, const std::vector<int> &fds, size_t start, size_t read_size,
+                   void *buffer) {
+    CHECK(fds.empty() || fds.size() == files.size());
+    // first file whose data ends after start
+    auto it = std::upper_bound(files.begin(), files.end(), start, [](size_t offset, const FileInfo &f) {
+        return offset < f.before_size + f.true_size;
+    });
+    size_t copied = 0;
+    for (; copied < read_size; it++) {
+        CHECK(it != files.end()) << "Range [" << start << ", " << start + read_size << ") is out of bounds";
+        size_t file_start = start + copied - it->before_size;
+        size_t size = std::min(read_size - copied, it->true_size - file_start);
+        if (size == 0) {
+            continue;
+        }
+        int fd = fds.empty() ? open(it->file_name.c_str(), O_RDONLY | O_DIRECT) : fds[it - files.begin()];
+        SYSCALL(fd);
+        ReadUnalignedRange(fd, it->file_name, file_start, size, (unsigned char *) buffer + copied);
+        if (fds.empty()) {
+            SYSCALL(close(fd));
+        }
+        copied += size;
+    }
+}
+
+void ReadFileRange(const std::vector<FileInfo> &files, size_t start, size_t read_size, void *buffer) {
+    ReadFileRange(files, {}, start, read_size, buffer);
+}
+
+/**
+ * Read a byte range of a dataset into a new buffer without copying it again. A range within one file is read straight
+ * into the buffer with a single aligned read, so it starts at an offset into the buffer; a range that spans files is
+ * gathered with ReadFileRange.
+ *
+ * @param files Files of the dataset; true_size and before_size must be populated (see GetFileInfo)
+ * @param data Set to the first byte of the range
+ * @return The buffer holding the range, to be released with free
+ */
+void *ReadFileRangeInPlace(const std::vector<FileInfo> &files, size_t start, size_t read_size, unsigned char **data) {
+    auto it = std::upper_bound(files.begin(), files.end(), start, [](size_t offset, const FileInfo &f) {
+        return offset < f.before_size + f.true_size;
+    });
+    if (it == files.end() || start + read_size > it->before_size + it->true_size) {
+        auto buffer = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT,
+                                                          AlignUp(std::max(read_size, 1UL)));
+        ReadFileRange(files, start, read_size, buffer);
+        *data = buffer;
+        return buffer;
+    }
+    size_t file_start = start - it->before_size;
+    size_t aligned_start = AlignDown(file_start);
+    size_t aligned_size = AlignUp(file_start + read_size) - aligned_start;
+    auto buffer = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT,
+                                                      std::max(aligned_size, O_DIRECT_MULTIPLE));
+    if (read_size > 0) {
+        int fd = open(it->file_name.c_str(), O_RDONLY | O_DIRECT);
+        SYSCALL(fd);
+        size_t result_size = ReadAlignedSpan(fd, aligned_start, aligned_size, buffer);
+        CHECK(result_size >= file_start - aligned_start + read_size) << "Short read from " << it->file_name;
+        SYSCALL(close(fd));
+    }
+    *data = buffer + (file_start - aligned_start);
+    return buffer;
+}
+
+/**
+ * Open every file with O_DIRECT for reading, e.g. to read many ranges with ReadFileRange without reopening them
+ */
+std::vector<int> OpenFiles(const std::vector<FileInfo> &files) {
+    std::vector<int> fds(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        fds[i] = open(files[i].file_name.c_str(), O_RDONLY | O_DIRECT);
+        SYSCALL(fds[i]);
+    }
+    return fds;
+}
+
+void CloseFiles(const std::vector<int> &fds) {
+    for (int fd: fds) {
+        SYSCALL(close(fd));
+    }
+}
+
 std::vector<std::string> GetSSDList() {
     CheckSSDList();
     return ssd_list;
@@ -237,6 +365,23 @@ void MakeFileEndMarker(unsigned char *buffer, size_t size, size_t real_size) {
     *(uint16_t*)(&buffer[size - METADATA_SIZE]) = (uint16_t)byte_diff;
 }
 
+/**
+ * Write a buffer as an entire file in the layout of the OrderedFileWriter: the last partial block ends with the size
+ * marker. The buffer must be aligned for O_DIRECT and hold at least AlignUp(true_size + METADATA_SIZE) bytes; its
+ * tail is overwritten by the marker.
+ *
+ * @return Size of the file
+ */
+size_t WriteFileWithEndMarker(const std::string &file_name, void *buffer, size_t true_size) {
+    size_t file_size = AlignUp(true_size + METADATA_SIZE);
+    MakeFileEndMarker((unsigned char *) buffer, file_size, true_size);
+    int fd = open(file_name.c_str(), O_WRONLY | O_DIRECT | O_CREAT | O_TRUNC, 0644);
+    SYSCALL(fd);
+    Write(fd, buffer, file_size);
+    SYSCALL(close(fd));
+    return file_size;
+}
+
 double GetThroughput(size_t size, double time) {
     return ((double) size / 1e9) / time;
 }
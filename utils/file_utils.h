@@ -55,6 +55,13 @@ void ReadFileOnce(const std::string &file_name, void *buffer, size_t start, size
 
 void* ReadEntireFile(const std::string &file_name, size_t read_size);
 
+void ReadFileRange(const std::vector<FileInfo> &files, size_t start, size_t read_size, void *buffer);
+void ReadFileRange(const std::vector<FileInfo> &files, const std::vector<int> &fds, size_t start, size_t read_size,
+                   void *buffer);
+void *ReadFileRangeInPlace(const std::vector<FileInfo> &files, size_t start, size_t read_size, unsigned char **data);
+std::vector<int> OpenFiles(const std::vector<FileInfo> &files);
+void CloseFiles(const std::vector<int> &fds);
+
 void PopulateSSDList();
 void PopulateSSDList(size_t count, bool random, bool verbose);
 void PopulateSSDList(const std::vector<int> &ssd_numbers, bool verbose);
@@ -62,6 +69,7 @@ std::string GetFileName(const std::string &prefix, size_t file_number);
 std::vector<std::string> GetSSDList();
 
 void MakeFileEndMarker(unsigned char *buffer, size_t size, size_t real_size);
+size_t WriteFileWithEndMarker(const std::string &file_name, void *buffer, size_t true_size);
 
 double GetThroughput(size_t size, double time);
 double GetThroughput(const std::vector<FileInfo> &files, double time);
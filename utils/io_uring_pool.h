@@ -0,0 +1,199 @@
+#ifndef SORTING_IO_URING_POOL_H
+#define SORTING_IO_URING_POOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <sys/resource.h>
+
+#include "liburing.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+#include "parlay/parallel.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/logger.h"
+
+/**
+ * Process-wide pool of io_uring instances for short batches of reads, such as RandomBatchRead.
+ *
+ * Ring memory is locked, so creating a ring per worker for every batch fails once RLIMIT_MEMLOCK is exhausted, which
+ * happens on machines with many threads or after kernel upgrades that make ring entries larger. The pool caps the
+ * number of rings by an estimate of their locked memory against half of the limit (the other half is left for rings
+ * that long-lived readers and writers create themselves), and lends them out; a thread holds a ring for the duration
+ * of a batch and waits if all rings are taken. Rings after the first attach to its async worker pool
+ * (IORING_SETUP_ATTACH_WQ). If a ring cannot be created anyway, the pool shrinks its depth (for the first ring) or its
+ * capacity (for later ones) and carries on with what it has.
+ *
+ * Pooled rings move between threads, so they are not created with IORING_SETUP_SINGLE_ISSUER. A borrower must reap
+ * all of its completions before it returns the ring.
+ */
+class IOUringPool {
+public:
+    class Ring {
+    public:
+        Ring(IOUringPool *pool, struct io_uring *ring) : pool(pool), ring(ring) {}
+
+        Ring(Ring &&other) noexcept: pool(other.pool), ring(other.ring) {
+            other.ring = nullptr;
+        }
+
+        Ring(const Ring &) = delete;
+
+        Ring &operator=(const Ring &) = delete;
+
+        Ring &operator=(Ring &&) = delete;
+
+        ~Ring() {
+            if (ring != nullptr) {
+                pool->Release(ring);
+            }
+        }
+
+        [[nodiscard]] struct io_uring *Get() const {
+            return ring;
+        }
+
+        /**
+         * @return Number of submission queue entries
+         */
+        [[nodiscard]] unsigned Entries() const {
+            return pool->entries;
+        }
+
+    private:
+        IOUringPool *pool;
+        struct io_uring *ring;
+    };
+
+    static IOUringPool &Instance() {
+        static IOUringPool pool;
+        return pool;
+    }
+
+    IOUringPool(const IOUringPool &) = delete;
+
+    IOUringPool &operator=(const IOUringPool &) = delete;
+
+    /**
+     * Borrow a ring until the returned handle goes out of scope; blocks while all rings are in use
+     */
+    Ring Acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (free_rings.empty()) {
+            if (rings.size() < capacity && Create()) {
+                break;
+            }
+            released.wait(lock);
+        }
+        struct io_uring *ring = free_rings.back();
+        free_rings.pop_back();
+        return {this, ring};
+    }
+
+    /**
+     * @return Number of rings that can be in use at the same time; callers should not split a batch into more shares
+     */
+    [[nodiscard]] size_t Capacity() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return capacity;
+    }
+
+private:
+    // sizes of a submission and a completion queue entry in the kernel ABI
+    static constexpr size_t SQE_SIZE = 64;
+    static constexpr size_t CQE_SIZE = 16;
+    static constexpr unsigned MAX_ENTRIES = 512;
+    static constexpr unsigned MIN_ENTRIES = 8;
+
+    std::mutex mutex;
+    std::condition_variable released;
+    std::vector<std::unique_ptr<struct io_uring>> rings;
+    std::vector<struct io_uring *> free_rings;
+    size_t capacity;
+    unsigned entries = MAX_ENTRIES;
+
+    IOUringPool() {
+        capacity = parlay::num_workers();
+        struct rlimit limit{};
+        SYSCALL(getrlimit(RLIMIT_MEMLOCK, &limit));
+        if (limit.rlim_cur != RLIM_INFINITY) {
+            size_t budget = limit.rlim_cur / 2;
+            while (entries > MIN_ENTRIES && GetRingSize(entries) > budget) {
+                entries /= 2;
+            }
+            capacity = std::clamp(budget / GetRingSize(entries), 1UL, capacity);
+        }
+        LOG(INFO) << "io_uring pool: up to " << capacity << " rings of " << entries << " entries";
+    }
+
+    ~IOUringPool() {
+        for (auto &ring: rings) {
+            io_uring_queue_exit(ring.get());
+        }
+    }
+
+    /**
+     * Estimate of the locked memory of a ring: the submission entries, and the completion entries (twice as many) with
+     * the submission index array and the ring headers
+     */
+    static size_t GetRingSize(unsigned num_entries) {
+        return AlignUp(num_entries * SQE_SIZE) + AlignUp(2 * num_entries * CQE_SIZE + num_entries * sizeof(unsigned)
+                                                         + O_DIRECT_MULTIPLE);
+    }
+
+    /**
+     * Add a free ring; the mutex must be held
+     *
+     * @return Whether a ring was created; if not, the capacity is lowered to the current number of rings
+     */
+    bool Create() {
+        auto ring = std::make_unique<struct io_uring>();
+        while (true) {
+            struct io_uring_params params{};
+            if (!rings.empty()) {
+                params.flags |= IORING_SETUP_ATTACH_WQ;
+                params.wq_fd = rings[0]->ring_fd;
+            }
+            int result = io_uring_queue_init_params(entries, ring.get(), &params);
+            if (result == -EINVAL && !rings.empty()) {
+                // kernels before 5.6 cannot share the async workers
+                params = {};
+                result = io_uring_queue_init_params(entries, ring.get(), &params);
+            }
+            if (result == 0) {
+                break;
+            }
+            if (rings.empty() && entries > MIN_ENTRIES) {
+                entries /= 2;
+                LOG(WARNING) << "io_uring pool: cannot create a ring (" << std::strerror(-result) << "); trying "
+                             << entries << " entries";
+                continue;
+            }
+            CHECK(!rings.empty()) << "Cannot create an io_uring (" << std::strerror(-result)
+                                  << "); raise the locked memory limit (ulimit -l)";
+            LOG(WARNING) << "io_uring pool: cannot create more rings (" << std::strerror(-result) << "); continuing "
+                         << "with " << rings.size() << ". Raise the locked memory limit (ulimit -l) for more "
+                         << "parallel I/O";
+            capacity = rings.size();
+            return false;
+        }
+        free_rings.push_back(ring.get());
+        rings.push_back(std::move(ring));
+        return true;
+    }
+
+    void Release(struct io_uring *ring) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_rings.push_back(ring);
+        }
+        released.notify_one();
+    }
+};
+
+#endif //SORTING_IO_URING_POOL_H
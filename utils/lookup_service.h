@@ -0,0 +1,218 @@
+#ifndef SORTING_LOOKUP_SERVICE_H
+#define SORTING_LOOKUP_SERVICE_H
+
+#include <vector>
+#include <thread>
+#include <future>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "liburing.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/logger.h"
+#include "utils/random_read.h"
+#include "utils/simple_queue.h"
+
+/**
+ * A long-running reader for the elements at given positions of a dataset, for steady streams of lookups from many
+ * client threads.
+ *
+ * Unlike RandomBatchRead, which sets everything up for a single batch, the service opens the files once and keeps a
+ * few I/O threads running, each with its own ring (with the files registered), read buffers and slots. Clients push
+ * requests to a shared submission queue; an I/O thread takes whatever is queued, up to its free slots, and submits it
+ * as one batch. While reads are in flight it only waits for completions briefly, so requests that arrive in the
+ * meantime join the next batch instead of waiting for the whole ring to drain.
+ *
+ * Results are delivered through futures or callbacks. Callbacks run on the I/O threads and should return quickly. A
+ * read that fails or comes back short is reported to its client instead of stopping the service.
+ *
+ * @tparam T Type of the elements
+ */
+template<typename T>
+class LookupService {
+public:
+    /**
+     * <code>void callback(const T &value, int error)</code>: error is 0 on success, or a negative errno value, in
+     * which case value is unspecified
+     */
+    typedef std::function<void(const T &, int)> Callback;
+
+    /**
+     * @param files Files of the dataset; true_size must be populated
+     * @param num_threads Number of I/O threads, each with its own ring
+     * @param queue_depth Maximum number of reads in flight per ring
+     */
+    explicit LookupService(const std::vector<FileInfo> &files, size_t num_threads = 4, size_t queue_depth = 256)
+            : queue_depth(queue_depth), fds(files.size()), size_prefix_sum(files.size()) {
+        for (size_t i = 0; i < files.size(); i++) {
+            size_prefix_sum[i] = files[i].true_size + (i == 0 ? 0 : size_prefix_sum[i - 1]);
+            fds[i] = open(files[i].file_name.c_str(), O_RDONLY | O_DIRECT);
+            SYSCALL(fds[i]);
+        }
+        num_elements = files.empty() ? 0 : size_prefix_sum.back() / sizeof(T);
+        // bounds the memory held by queued requests when the clients outpace the SSDs
+        submission_queue.SetSizeLimit(64 * queue_depth * num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            io_threads.emplace_back([this]() { RunIOThread(); });
+        }
+    }
+
+    LookupService(const LookupService &) = delete;
+
+    LookupService &operator=(const LookupService &) = delete;
+
+    /**
+     * Complete the queued requests, then stop the I/O threads
+     */
+    ~LookupService() {
+        submission_queue.Close();
+        for (auto &thread: io_threads) {
+            thread.join();
+        }
+        for (int fd: fds) {
+            SYSCALL(close(fd));
+        }
+    }
+
+    /**
+     * Read the element at a global position (in elements) and pass it to the callback. A position past the end of the
+     * dataset is rejected right away: the callback runs on the calling thread with <code>-EINVAL</code>.
+     */
+    void Lookup(size_t position, Callback callback) {
+        if (position >= num_elements) {
+            callback(T{}, -EINVAL);
+            return;
+        }
+        submission_queue.Push({position, std::move(callback)});
+    }
+
+    /**
+     * @return A future for the element at a global position; a failed lookup stores a std::system_error
+     */
+    std::future<T> Lookup(size_t position) {
+        auto promise = std::make_shared<std::promise<T>>();
+        auto future = promise->get_future();
+        Lookup(position, [promise, position](const T &t, int error) {
+            if (error == 0) {
+                promise->set_value(t);
+            } else {
+                promise->set_exception(std::make_exception_ptr(std::system_error(
+                        -error, std::generic_category(), "Lookup of position " + std::to_string(position))));
+            }
+        });
+        return future;
+    }
+
+private:
+    struct Request {
+        size_t position = 0;
+        Callback callback;
+    };
+
+    // how long an I/O thread with reads in flight waits for a completion before checking for new requests
+    static constexpr long long COMPLETION_WAIT_NS = 20000;
+    static constexpr size_t BUFFER_SIZE = GetRandomBatchReadBufferSize(sizeof(T));
+
+    size_t queue_depth;
+    std::vector<int> fds;
+    std::vector<size_t> size_prefix_sum;
+    size_t num_elements = 0;
+    SimpleQueue<Request> submission_queue;
+    std::vector<std::thread> io_threads;
+
+    void RunIOThread() {
+        // the ring lives as long as the service, so it is not borrowed from IOUringPool; its locked memory comes out of
+        // the half of the limit that the pool leaves to long-lived rings
+        struct io_uring ring;
+        int init_result = io_uring_queue_init(queue_depth, &ring, IORING_SETUP_SINGLE_ISSUER);
+        CHECK(init_result == 0) << "Lookup service: cannot create an io_uring with " << queue_depth << " entries ("
+                                << std::strerror(-init_result) << "); raise the locked memory limit (ulimit -l) or "
+                                << "use fewer threads or a smaller queue depth";
+        // registered files save the file table lookup of every read; fall back to plain descriptors if unsupported
+        bool fixed_files = io_uring_register_files(&ring, fds.data(), fds.size()) == 0;
+        if (!fixed_files) {
+            LOG(WARNING) << "Lookup service: cannot register files; using plain file descriptors";
+        }
+        auto buffers = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, queue_depth * BUFFER_SIZE);
+        std::vector<Request> slots(queue_depth);
+        std::vector<size_t> offsets(queue_depth), free_slots;
+        for (size_t i = 0; i < queue_depth; i++) {
+            free_slots.push_back(i);
+        }
+        std::vector<Request> batch;
+        size_t in_flight = 0;
+        bool open = true;
+        while (open || in_flight > 0) {
+            // block for new requests only when there is nothing to reap
+            batch.clear();
+            if (open && !free_slots.empty()) {
+                auto code = submission_queue.PollMany(batch, free_slots.size(), in_flight == 0 ? -1 : 0);
+                open = code != QueueCode::FINISH;
+            }
+            for (auto &request: batch) {
+                size_t byte_offset = request.position * sizeof(T);
+                // Lookup has checked the position, so the element is in one of the files
+                size_t file_num = std::upper_bound(size_prefix_sum.begin(), size_prefix_sum.end(), byte_offset)
+                                  - size_prefix_sum.begin();
+                size_t file_offset = file_num == 0 ? byte_offset : byte_offset - size_prefix_sum[file_num - 1];
+                size_t start = AlignDown(file_offset), end = AlignUp(file_offset + sizeof(T));
+                size_t slot = free_slots.back();
+                free_slots.pop_back();
+                offsets[slot] = file_offset - start;
+                slots[slot] = std::move(request);
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, fixed_files ? (int) file_num : fds[file_num], buffers + slot * BUFFER_SIZE,
+                                   end - start, start);
+                if (fixed_files) {
+                    sqe->flags |= IOSQE_FIXED_FILE;
+                }
+                io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(slot));
+            }
+            if (!batch.empty()) {
+                int submitted = io_uring_submit(&ring);
+                CHECK(submitted >= 0) << "io_uring_submit failed: " << std::strerror(-submitted);
+                in_flight += batch.size();
+            }
+            if (in_flight == 0) {
+                continue;
+            }
+            struct io_uring_cqe *cqe;
+            struct __kernel_timespec timeout{0, COMPLETION_WAIT_NS};
+            // with no free slot (or no more requests coming), nothing else can happen until a read completes
+            int result = free_slots.empty() || !open ? io_uring_wait_cqe(&ring, &cqe)
+                                                     : io_uring_wait_cqe_timeout(&ring, &cqe, &timeout);
+            while (result == 0) {
+                int read_result = cqe->res;
+                auto slot = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+                io_uring_cqe_seen(&ring, cqe);
+                in_flight--;
+                int error = read_result < 0 ? read_result : 0;
+                if (read_result >= 0 && (size_t) read_result < offsets[slot] + sizeof(T)) {
+                    // the read ended before the element did
+                    error = -EIO;
+                }
+                slots[slot].callback(*reinterpret_cast<T *>(buffers + slot * BUFFER_SIZE + offsets[slot]), error);
+                slots[slot].callback = nullptr;
+                free_slots.push_back(slot);
+                result = io_uring_peek_cqe(&ring, &cqe);
+            }
+        }
+        if (fixed_files) {
+            io_uring_unregister_files(&ring);
+        }
+        io_uring_queue_exit(&ring);
+        free(buffers);
+    }
+};
+
+#endif //SORTING_LOOKUP_SERVICE_H
@@ -6,19 +6,33 @@
 #define SORTING_RANDOM_READ_H
 
 #include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 #include "liburing.h"
 #include "absl/log/log.h"
+#include "absl/log/check.h"
+#include "parlay/primitives.h"
 #include "parlay/sequence.h"
 
 #include "configs.h"
 #include "utils/file_utils.h"
 #include "utils/logger.h"
+#include "utils/io_uring_pool.h"
 
 constexpr size_t GetRandomBatchReadBufferSize(size_t size) {
     return AlignUp(size + O_DIRECT_MULTIPLE - 1);
 }
 
+/**
+ * Read the elements at the given positions of a dataset that spans multiple files
+ *
+ * @param files Files of the dataset; true_size must be populated
+ * @param requests Global positions (in elements) of the elements to read
+ * @return The element at each requested position, in the order of the requests
+ */
 template<typename T>
 parlay::sequence<T> RandomBatchRead(const std::vector<FileInfo> &files,
                                     const parlay::sequence<size_t> &requests) {
@@ -35,6 +49,8 @@ parlay::sequence<T> RandomBatchRead(const std::vector<FileInfo> &files,
 
     struct ReadRequest {
         size_t offset;
+        // position of the request within its segment
+        size_t request_index;
         unsigned char buffer[GetRandomBatchReadBufferSize(sizeof(T))];
     };
 
@@ -45,7 +61,7 @@ parlay::sequence<T> RandomBatchRead(const std::vector<FileInfo> &files,
         SYSCALL(fds[i]);
     }, 1);
 
-    const size_t num_threads = parlay::num_workers();
+    const size_t num_threads = std::min(parlay::num_workers(), IOUringPool::Instance().Capacity());
     const size_t segment_size = (requests.size() + num_threads - 1) / num_threads;
 
     return parlay::flatten(parlay::map(parlay::iota(num_threads), [&](size_t segment) {
@@ -55,44 +71,46 @@ parlay::sequence<T> RandomBatchRead(const std::vector<FileInfo> &files,
             return parlay::sequence<T>();
         }
 
-        const size_t NUM_BUFFERS = 4096 * 4;
+        auto results = parlay::sequence<T>::uninitialized(segment_end - segment_start);
+
+        // one ring per thread would exhaust the locked memory limit on large machines; borrow one from the pool
+        auto pooled_ring = IOUringPool::Instance().Acquire();
+        struct io_uring &ring = *pooled_ring.Get();
+        // pooled rings may be as shallow as IOUringPool::MIN_ENTRIES; never keep more reads in flight than the ring
+        // holds, or completions would overflow its completion queue
+        const size_t NUM_BUFFERS = pooled_ring.Entries();
         auto *buffers = (ReadRequest *) malloc(sizeof(ReadRequest) * NUM_BUFFERS);
         std::vector<size_t> free_buffers;
         for (size_t i = 0; i < NUM_BUFFERS; i++) {
             free_buffers.push_back(i);
         }
-
-        parlay::sequence<T> results;
-        results.reserve(segment_end - segment_start);
-
-        // If there are too many threads, io_uring_queue_init will fail due to insufficient locked memory
-        const unsigned IO_URING_ENTRIES = 512;
-        struct io_uring ring;
-        SYSCALL(io_uring_queue_init(IO_URING_ENTRIES, &ring, IORING_SETUP_SINGLE_ISSUER));
-        size_t i = segment_start, pending_requests = 0, requests_in_ring = 0;
+        size_t i = segment_start, requests_in_ring = 0;
         while (i < segment_end || requests_in_ring > 0) {
             // there are available buffers and remaining requests; keep submitting
+            size_t pending_requests = 0;
             while (i < segment_end && !free_buffers.empty()) {
                 auto byte_offset = requests[i] * sizeof(T);
+                auto file_num = std::upper_bound(size_prefix_sum, size_prefix_sum + num_files, byte_offset)
+                                - size_prefix_sum;
+                CHECK((size_t)file_num < num_files);
+                // blocks are aligned within each file; true sizes need not be multiples of O_DIRECT_MULTIPLE
+                size_t file_offset = file_num == 0 ? byte_offset : byte_offset - size_prefix_sum[file_num - 1];
                 // Start and end of aligned read (both multiples of O_DIRECT_MULTIPLE)
-                size_t start = AlignDown(byte_offset), end = AlignUp(byte_offset + sizeof(T));
+                size_t start = AlignDown(file_offset), end = AlignUp(file_offset + sizeof(T));
                 size_t buffer_index = free_buffers.back();
                 free_buffers.pop_back();
-                buffers[buffer_index].offset = byte_offset - start;
-                auto file_num = std::upper_bound(size_prefix_sum, size_prefix_sum + num_files, start) - size_prefix_sum;
-                CHECK((size_t)file_num < num_files);
+                buffers[buffer_index].offset = file_offset - start;
+                buffers[buffer_index].request_index = i - segment_start;
                 struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
-                io_uring_prep_read(sqe, fds[file_num], buffers[buffer_index].buffer, end - start,
-                                   file_num == 0 ? start : start - size_prefix_sum[file_num - 1]);
+                io_uring_prep_read(sqe, fds[file_num], buffers[buffer_index].buffer, end - start, start);
                 io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(buffer_index));
                 i++;
                 pending_requests++;
-                if (pending_requests == IO_URING_ENTRIES || i == segment_end) {
-                    int submitted = io_uring_submit(&ring);
-                    SYSCALL(submitted);
-                    requests_in_ring += submitted;
-                    pending_requests = 0;
-                }
+            }
+            if (pending_requests > 0) {
+                int submitted = io_uring_submit(&ring);
+                CHECK(submitted >= 0) << "io_uring_submit failed: " << std::strerror(-submitted);
+                requests_in_ring += submitted;
             }
             // at this point, we have submitted as much as we can; now is time to reap
             bool wait = true;
@@ -113,14 +131,271 @@ parlay::sequence<T> RandomBatchRead(const std::vector<FileInfo> &files,
                 auto buffer_index = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
                 free_buffers.push_back(buffer_index);
                 ReadRequest *buffer = &buffers[buffer_index];
-                results.push_back(*reinterpret_cast<T *>(buffer->buffer + buffer->offset));
+                results[buffer->request_index] = *reinterpret_cast<T *>(buffer->buffer + buffer->offset);
             }
         }
-        io_uring_queue_exit(&ring);
         free(buffers);
 
         return results;
     }, 1));
 }
 
+// bytes of staging buffers that a ring of RandomBatchReadRanges may have in flight; a single read may exceed it
+constexpr size_t RANDOM_READ_RANGES_STAGING_SIZE = 2 * READER_READ_SIZE;
+
+/**
+ * Read byte ranges of a dataset that spans multiple files, as a gather: range i lands at the i-th slot of the output,
+ * regardless of the order in which the reads complete.
+ *
+ * A range may span many blocks and cross file boundaries. Ranges are cut at file boundaries and into pieces of at most
+ * READER_READ_SIZE bytes; every worker reads a contiguous share of the pieces with a ring from IOUringPool, keeping up
+ * to a ring's worth of aligned reads in flight.
+ *
+ * When a piece sits at the same offset within a block in the file and in the output, its whole blocks are read
+ * straight into the output, and only the partial blocks at its ends go through a staging buffer. Any other piece is
+ * staged whole. The staging buffers in flight on a ring are capped at RANDOM_READ_RANGES_STAGING_SIZE bytes.
+ *
+ * @param files Files of the dataset; true_size must be populated
+ * @param ranges Global byte offset and length of each range
+ * @param output Receives the ranges back to back, in the order of the requests
+ */
+inline void RandomBatchReadRanges(const std::vector<FileInfo> &files,
+                                  const parlay::sequence<std::pair<size_t, size_t>> &ranges,
+                                  void *output) {
+    const size_t num_files = files.size();
+    std::vector<size_t> size_prefix_sum(num_files);
+    for (size_t i = 0; i < num_files; i++) {
+        size_prefix_sum[i] = files[i].true_size + (i == 0 ? 0 : size_prefix_sum[i - 1]);
+    }
+    auto output_offsets = parlay::scan(parlay::map(ranges, [](const auto &range) { return range.second; })).first;
+
+    struct Piece {
+        size_t file_num;
+        size_t file_offset;
+        size_t length;
+        size_t output_offset;
+    };
+    // calls emit with the pieces of a range, in order
+    const auto split = [&](size_t i, auto emit) {
+        auto [byte_offset, length] = ranges[i];
+        CHECK(num_files > 0 && byte_offset + length <= size_prefix_sum.back()) << "Range " << i << " is out of bounds";
+        size_t file_num = std::upper_bound(size_prefix_sum.begin(), size_prefix_sum.end(), byte_offset)
+                          - size_prefix_sum.begin();
+        for (size_t done = 0; done < length;) {
+            size_t file_start = file_num == 0 ? 0 : size_prefix_sum[file_num - 1];
+            size_t file_offset = byte_offset + done - file_start;
+            size_t piece = std::min({length - done, files[file_num].true_size - file_offset, READER_READ_SIZE});
+            if (piece > 0) {
+                emit(Piece{file_num, file_offset, piece, output_offsets[i] + done});
+                done += piece;
+            }
+            // empty files yield no pieces
+            if (file_offset + piece == files[file_num].true_size) {
+                file_num++;
+            }
+        }
+    };
+    auto piece_offsets = parlay::scan(parlay::map(parlay::iota(ranges.size()), [&](size_t i) {
+        size_t count = 0;
+        split(i, [&](const Piece &) { count++; });
+        return count;
+    }));
+    auto pieces = parlay::sequence<Piece>::uninitialized(piece_offsets.second);
+    parlay::parallel_for(0, ranges.size(), [&](size_t i) {
+        size_t next = piece_offsets.first[i];
+        split(i, [&](const Piece &piece) { pieces[next++] = piece; });
+    });
+
+    std::vector<int> fds(num_files);
+    parlay::parallel_for(0, num_files, [&](size_t i) {
+        fds[i] = open(files[i].file_name.c_str(), O_RDONLY | O_DIRECT);
+        SYSCALL(fds[i]);
+    }, 1);
+
+    // an aligned read of a file; staged reads copy [offset, offset + length) of their buffer to the output afterwards
+    struct ReadRequest {
+        size_t file_num;
+        size_t start;
+        size_t size;
+        unsigned char *buffer;
+        bool staged;
+        size_t offset;
+        size_t length;
+        unsigned char *destination;
+    };
+    // calls emit with the reads of a piece
+    const auto plan = [&](const Piece &piece, auto emit) {
+        auto destination = (unsigned char *) output + piece.output_offset;
+        size_t piece_end = piece.file_offset + piece.length;
+        size_t first_block = AlignUp(piece.file_offset), last_block = AlignDown(piece_end);
+        const auto staged = [&](size_t from, size_t to) {
+            size_t start = AlignDown(from);
+            emit(ReadRequest{piece.file_num, start, AlignUp(to) - start, nullptr, true, from - start, to - from,
+                             destination + (from - piece.file_offset)});
+        };
+        bool in_place = ((uintptr_t) destination - piece.file_offset) % O_DIRECT_MEMORY_ALIGNMENT == 0;
+        if (!in_place || first_block >= last_block) {
+            staged(piece.file_offset, piece_end);
+            return;
+        }
+        if (piece.file_offset < first_block) {
+            staged(piece.file_offset, first_block);
+        }
+        emit(ReadRequest{piece.file_num, first_block, last_block - first_block,
+                         destination + (first_block - piece.file_offset), false, 0, last_block - first_block,
+                         nullptr});
+        if (last_block < piece_end) {
+            staged(last_block, piece_end);
+        }
+    };
+
+    const size_t num_threads = std::min(parlay::num_workers(), IOUringPool::Instance().Capacity());
+    const size_t segment_size = (pieces.size() + num_threads - 1) / num_threads;
+    parlay::parallel_for(0, num_threads, [&](size_t segment) {
+        const size_t segment_start = segment_size * segment;
+        const size_t segment_end = std::min(segment_size * (segment + 1), pieces.size());
+        if (segment_end <= segment_start) {
+            return;
+        }
+        auto pooled_ring = IOUringPool::Instance().Acquire();
+        struct io_uring &ring = *pooled_ring.Get();
+        const unsigned IO_URING_ENTRIES = pooled_ring.Entries();
+        std::vector<ReadRequest> requests(IO_URING_ENTRIES);
+        std::vector<size_t> free_slots;
+        for (size_t i = 0; i < IO_URING_ENTRIES; i++) {
+            free_slots.push_back(i);
+        }
+        // reads of the current piece that have not been submitted yet, last one first
+        std::vector<ReadRequest> planned;
+        size_t i = segment_start, requests_in_ring = 0, staged_bytes = 0;
+        while (i < segment_end || !planned.empty() || requests_in_ring > 0) {
+            size_t pending_requests = 0;
+            while (!free_slots.empty()) {
+                if (planned.empty()) {
+                    if (i == segment_end) {
+                        break;
+                    }
+                    plan(pieces[i++], [&](const ReadRequest &request) { planned.push_back(request); });
+                    std::reverse(planned.begin(), planned.end());
+                }
+                ReadRequest &request = planned.back();
+                if (request.staged) {
+                    if (staged_bytes > 0 && staged_bytes + request.size > RANDOM_READ_RANGES_STAGING_SIZE) {
+                        break;
+                    }
+                    request.buffer = (unsigned char *) std::aligned_alloc(O_DIRECT_MEMORY_ALIGNMENT, request.size);
+                    staged_bytes += request.size;
+                }
+                size_t slot = free_slots.back();
+                free_slots.pop_back();
+                requests[slot] = request;
+                planned.pop_back();
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, fds[request.file_num], request.buffer, request.size, request.start);
+                io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(slot));
+                pending_requests++;
+            }
+            if (pending_requests > 0) {
+                int submitted = io_uring_submit(&ring);
+                CHECK(submitted >= 0) << "io_uring_submit failed: " << std::strerror(-submitted);
+                requests_in_ring += submitted;
+            }
+            // wait for one completion, then reap whatever else is ready
+            bool wait = true;
+            while (requests_in_ring > 0) {
+                struct io_uring_cqe *cqe;
+                if (wait) {
+                    SYSCALL(io_uring_wait_cqe(&ring, &cqe));
+                    wait = false;
+                } else if (io_uring_peek_cqe(&ring, &cqe) != 0) {
+                    break;
+                }
+                int result = cqe->res;
+                SYSCALL(result);
+                auto slot = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+                io_uring_cqe_seen(&ring, cqe);
+                requests_in_ring--;
+                const ReadRequest &request = requests[slot];
+                CHECK((size_t) result >= request.offset + request.length) << "Short read";
+                if (request.staged) {
+                    memcpy(request.destination, request.buffer + request.offset, request.length);
+                    free(request.buffer);
+                    staged_bytes -= request.size;
+                }
+                free_slots.push_back(slot);
+            }
+        }
+    }, 1);
+    for (int fd: fds) {
+        SYSCALL(close(fd));
+    }
+}
+
+/**
+ * Read the elements at the given positions of a dataset like RandomBatchRead, but with fewer and larger reads when
+ * requests are dense (e.g. oversampling or lookups into a small dataset).
+ *
+ * Requests are sorted by position, which orders them by file and by block. Requests that share a block, or whose blocks
+ * are at most RANDOM_READ_MAX_GAP bytes apart, are served by a single read; a read never crosses a multiple of
+ * max_read_size within its file, which bounds its size. The reads go out through RandomBatchReadRanges.
+ *
+ * @param files Files of the dataset; true_size must be populated
+ * @param requests Global positions (in elements) of the elements to read
+ * @param max_read_size Bytes per read; a multiple of O_DIRECT_MULTIPLE
+ * @return The element at each requested position, in the order of the requests
+ */
+template<typename T>
+parlay::sequence<T> RandomBatchReadCoalesced(const std::vector<FileInfo> &files,
+                                             const parlay::sequence<size_t> &requests,
+                                             size_t max_read_size = RANDOM_READ_COALESCE_SIZE) {
+    const size_t n = requests.size();
+    auto results = parlay::sequence<T>::uninitialized(n);
+    if (n == 0) {
+        return results;
+    }
+    std::vector<size_t> size_prefix_sum(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        size_prefix_sum[i] = files[i].true_size + (i == 0 ? 0 : size_prefix_sum[i - 1]);
+    }
+    // global position and index of every request, in the order in which they are read
+    auto sorted = parlay::sort(parlay::tabulate(n, [&](size_t i) { return std::make_pair(requests[i], i); }));
+    auto locations = parlay::map(sorted, [&](const auto &request) {
+        size_t byte_offset = request.first * sizeof(T);
+        size_t file_num = std::upper_bound(size_prefix_sum.begin(), size_prefix_sum.end(), byte_offset)
+                          - size_prefix_sum.begin();
+        CHECK(file_num < files.size()) << "Position " << request.first << " is out of bounds";
+        return std::make_pair(file_num, file_num == 0 ? byte_offset : byte_offset - size_prefix_sum[file_num - 1]);
+    });
+    // a request starts a new read unless its blocks can be appended to the read of the previous request
+    auto read_starts = parlay::filter(parlay::iota(n), [&](size_t j) {
+        if (j == 0) {
+            return true;
+        }
+        auto [file, offset] = locations[j];
+        auto [prev_file, prev_offset] = locations[j - 1];
+        return file != prev_file || offset / max_read_size != prev_offset / max_read_size
+               || AlignDown(offset) > AlignUp(prev_offset + sizeof(T)) + RANDOM_READ_MAX_GAP;
+    });
+    const size_t num_reads = read_starts.size();
+    const auto read_end = [&](size_t r) { return r + 1 < num_reads ? read_starts[r + 1] : n; };
+    // each read covers its requests exactly and lies within one file; RandomBatchReadRanges aligns it to blocks
+    auto ranges = parlay::tabulate(num_reads, [&](size_t r) {
+        size_t first = sorted[read_starts[r]].first, last = sorted[read_end(r) - 1].first;
+        return std::make_pair(first * sizeof(T), (last - first + 1) * sizeof(T));
+    });
+    auto output_offsets = parlay::scan(parlay::map(ranges, [](const auto &range) { return range.second; }));
+    auto output = parlay::sequence<unsigned char>::uninitialized(output_offsets.second);
+    RandomBatchReadRanges(files, ranges, output.data());
+    DLOG(INFO) << "Coalesced " << n << " requests into " << num_reads << " reads";
+
+    parlay::parallel_for(0, num_reads, [&](size_t r) {
+        const unsigned char *data = output.data() + output_offsets.first[r];
+        size_t first = sorted[read_starts[r]].first;
+        for (size_t j = read_starts[r]; j < read_end(r); j++) {
+            memcpy(&results[sorted[j].second], data + (sorted[j].first - first) * sizeof(T), sizeof(T));
+        }
+    });
+    return results;
+}
+
 #endif //SORTING_RANDOM_READ_H
@@ -6,6 +6,7 @@
 #define SORTING_SIMPLE_QUEUE_H
 
 #include <queue>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include "absl/log/check.h"
@@ -56,6 +57,37 @@ public:
         return {ret, QueueCode::SUCCESS};
     }
 
+    /**
+     * Move up to max_items elements to the end of out under a single lock, waiting for the first one like Poll
+     */
+    QueueCode PollMany(std::vector<T> &out, size_t max_items, int64_t timeout = -1) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (queue.empty()) {
+            if (!open) {
+                return QueueCode::FINISH;
+            }
+            if (timeout == -1) {
+                reader_cond.wait(lock);
+            } else if (timeout == 0) {
+                return QueueCode::TIMEOUT;
+            } else {
+                auto result = reader_cond.wait_for(lock,
+                                                   std::chrono::duration(std::chrono::microseconds(timeout)));
+                if (result == std::cv_status::timeout) {
+                    return QueueCode::TIMEOUT;
+                }
+            }
+        }
+        for (size_t i = 0; i < max_items && !queue.empty(); i++) {
+            out.push_back(std::move(queue.front()));
+            queue.pop();
+        }
+        if (size_limit) {
+            writer_cond.notify_all();
+        }
+        return QueueCode::SUCCESS;
+    }
+
     void Close() {
         std::lock_guard<std::mutex> lock(mutex);
         open = false;
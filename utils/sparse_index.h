@@ -0,0 +1,297 @@
+#ifndef SORTING_SPARSE_INDEX_H
+#define SORTING_SPARSE_INDEX_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <optional>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+
+#include "parlay/primitives.h"
+#include "absl/log/log.h"
+#include "absl/log/check.h"
+
+#include "configs.h"
+#include "utils/file_utils.h"
+#include "utils/random_read.h"
+
+/**
+ * A sparse index over a sorted dataset that spans multiple files, which turns the output of a sort into a table for
+ * point lookups and range scans.
+ *
+ * Every file is cut into blocks of a fixed number of elements, and the index keeps the first element of every block.
+ * The first element of a file's first block is the file's splitter. Searches run over a copy of the keys in Eytzinger
+ * (BFS) order, where the first levels of the implicit tree share a few cache lines. A lookup therefore costs one
+ * in-memory search and at most one block read; the reads of a batch of lookups go out together through
+ * RandomBatchReadRanges.
+ *
+ * The index can be filled while the dataset is being written (see SampleSort::Sort) or built from existing files.
+ *
+ * @tparam T Type of the elements; must be trivially copyable
+ */
+template<typename T, typename Comparator = std::less<T>>
+class SparseIndex {
+public:
+    /**
+     * @param block_size Bytes per block; smaller blocks cost more memory but make every lookup read less
+     */
+    explicit SparseIndex(Comparator comp = {}, size_t block_size = O_DIRECT_MULTIPLE)
+            : comp(comp), block_elements(std::max(1UL, block_size / sizeof(T))) {}
+
+    /**
+     * Record the first element of every block of a result file while it is still in memory. May be called
+     * concurrently for different files.
+     *
+     * @param file_index Index of the file among the result files passed to Finish
+     */
+    void AddFile(size_t file_index, const T *data, size_t n) {
+        auto keys = parlay::tabulate((n + block_elements - 1) / block_elements, [&](size_t b) {
+            return data[b * block_elements];
+        });
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        if (pending_keys.size() <= file_index) {
+            pending_keys.resize(file_index + 1);
+        }
+        pending_keys[file_index] = std::move(keys);
+    }
+
+    /**
+     * Complete an index filled by AddFile once the result files are written
+     */
+    void Finish(const std::vector<FileInfo> &result_files) {
+        files.clear();
+        parlay::sequence<parlay::sequence<T>> keys;
+        for (size_t i = 0; i < result_files.size(); i++) {
+            if (result_files[i].true_size == 0) {
+                continue;
+            }
+            CHECK(i < pending_keys.size() && pending_keys[i].size() == GetNumBlocks(result_files[i]))
+                << "No keys were recorded for " << result_files[i].file_name;
+            files.push_back(result_files[i]);
+            keys.push_back(std::move(pending_keys[i]));
+        }
+        pending_keys.clear();
+        first_keys = parlay::flatten(keys);
+        Initialize();
+    }
+
+    /**
+     * Build the index over sorted files that were written without one; reads the first element of every block
+     *
+     * @param sorted_files true_size must be populated
+     */
+    void Build(const std::vector<FileInfo> &sorted_files) {
+        files.clear();
+        std::copy_if(sorted_files.begin(), sorted_files.end(), std::back_inserter(files),
+                     [](const FileInfo &f) { return f.true_size > 0; });
+        ComputeBeforeSize(files);
+        auto positions = parlay::flatten(parlay::map(files, [&](const FileInfo &f) {
+            return parlay::tabulate(GetNumBlocks(f), [&](size_t b) {
+                return f.before_size / sizeof(T) + b * block_elements;
+            });
+        }));
+        first_keys = RandomBatchReadCoalesced<T>(files, positions);
+        Initialize();
+    }
+
+    void Save(const std::string &file_name) const {
+        std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+        const auto write = [&](size_t value) {
+            out.write((const char *) &value, sizeof(value));
+        };
+        write(block_elements);
+        write(files.size());
+        for (const auto &f: files) {
+            write(f.file_name.size());
+            out.write(f.file_name.data(), (std::streamsize) f.file_name.size());
+            write(f.true_size);
+            write(f.file_size);
+        }
+        write(first_keys.size());
+        out.write((const char *) first_keys.data(), (std::streamsize) (first_keys.size() * sizeof(T)));
+        CHECK(out.good()) << "Cannot write " << file_name;
+    }
+
+    /**
+     * Replace the index with one written by Save; the block size is taken from the file
+     */
+    void Load(const std::string &file_name) {
+        std::ifstream in(file_name, std::ios::binary);
+        CHECK(in.good()) << "Cannot read " << file_name;
+        const auto read = [&]() {
+            size_t value = 0;
+            in.read((char *) &value, sizeof(value));
+            return value;
+        };
+        block_elements = read();
+        files.resize(read());
+        for (size_t i = 0; i < files.size(); i++) {
+            auto &f = files[i];
+            f.file_name.resize(read());
+            in.read(f.file_name.data(), (std::streamsize) f.file_name.size());
+            f.file_index = i;
+            f.true_size = read();
+            f.file_size = read();
+        }
+        first_keys = parlay::sequence<T>::uninitialized(read());
+        in.read((char *) first_keys.data(), (std::streamsize) (first_keys.size() * sizeof(T)));
+        CHECK(!in.fail()) << "Malformed index " << file_name;
+        Initialize();
+    }
+
+    /**
+     * Global position of the first element that is not less than each key (std::lower_bound), and that element if
+     * there is one
+     */
+    std::pair<parlay::sequence<size_t>, parlay::sequence<std::optional<T>>>
+    LowerBounds(const parlay::sequence<T> &keys) const {
+        // the answer is in the block before the first block that starts at or after the key, or starts that block
+        auto blocks = parlay::map(keys, [&](const T &key) { return FindBlock(key); });
+        auto to_read = parlay::sort(parlay::map(parlay::filter(blocks, [](size_t b) { return b > 0; }),
+                                                [](size_t b) { return b - 1; }));
+        to_read.erase(std::unique(to_read.begin(), to_read.end()), to_read.end());
+        auto block_offsets = parlay::scan(parlay::map(to_read, [&](size_t b) { return GetBlockSize(b); })).first;
+        auto data = parlay::sequence<T>::uninitialized(to_read.empty() ? 0 : block_offsets.back()
+                                                                              + GetBlockSize(to_read.back()));
+        RandomBatchReadRanges(files, parlay::map(to_read, [&](size_t b) {
+            return std::make_pair(GetBlockStart(b) * sizeof(T), GetBlockSize(b) * sizeof(T));
+        }), data.data());
+
+        parlay::sequence<size_t> positions(keys.size());
+        parlay::sequence<std::optional<T>> values(keys.size());
+        parlay::parallel_for(0, keys.size(), [&](size_t i) {
+            size_t b = blocks[i];
+            if (b > 0) {
+                size_t slot = std::lower_bound(to_read.begin(), to_read.end(), b - 1) - to_read.begin();
+                const T *start = data.data() + block_offsets[slot], *end = start + GetBlockSize(b - 1);
+                const T *it = std::lower_bound(start, end, keys[i], comp);
+                if (it != end) {
+                    positions[i] = GetBlockStart(b - 1) + (it - start);
+                    values[i] = *it;
+                    return;
+                }
+            }
+            positions[i] = GetBlockStart(b);
+            if (b < first_keys.size()) {
+                values[i] = first_keys[b];
+            }
+        });
+        return {std::move(positions), std::move(values)};
+    }
+
+    /**
+     * @return For each key, the first element that compares equal to it, if any
+     */
+    parlay::sequence<std::optional<T>> Lookup(const parlay::sequence<T> &keys) const {
+        auto values = LowerBounds(keys).second;
+        parlay::parallel_for(0, keys.size(), [&](size_t i) {
+            if (values[i] && comp(keys[i], *values[i])) {
+                values[i].reset();
+            }
+        });
+        return values;
+    }
+
+    /**
+     * @return All elements in [low, high), in order
+     */
+    parlay::sequence<T> RangeScan(const T &low, const T &high) const {
+        auto positions = LowerBounds(parlay::sequence<T>({low, high})).first;
+        size_t start = positions[0], end = std::max(positions[0], positions[1]);
+        auto result = parlay::sequence<T>::uninitialized(end - start);
+        RandomBatchReadRanges(files, parlay::sequence<std::pair<size_t, size_t>>(
+                {{start * sizeof(T), (end - start) * sizeof(T)}}), result.data());
+        return result;
+    }
+
+    [[nodiscard]] const std::vector<FileInfo> &Files() const {
+        return files;
+    }
+
+    [[nodiscard]] size_t NumBlocks() const {
+        return first_keys.size();
+    }
+
+private:
+    Comparator comp;
+    size_t block_elements;
+    // non-empty files of the dataset in order; before_size is populated
+    std::vector<FileInfo> files;
+    // first element of every block, in order
+    parlay::sequence<T> first_keys;
+    // index of the first block of every file, followed by the number of blocks
+    std::vector<size_t> file_first_block;
+    // first_keys in Eytzinger order, starting at index 1, and the block of each of them
+    parlay::sequence<T> eytzinger;
+    parlay::sequence<size_t> eytzinger_block;
+
+    std::mutex pending_mutex;
+    std::vector<parlay::sequence<T>> pending_keys;
+
+    [[nodiscard]] size_t GetNumBlocks(const FileInfo &f) const {
+        return (f.true_size / sizeof(T) + block_elements - 1) / block_elements;
+    }
+
+    void Initialize() {
+        ComputeBeforeSize(files);
+        file_first_block.assign(1, 0);
+        for (const auto &f: files) {
+            file_first_block.push_back(file_first_block.back() + GetNumBlocks(f));
+        }
+        CHECK(file_first_block.back() == first_keys.size()) << "The index does not match its files";
+        eytzinger = parlay::sequence<T>(first_keys.size() + 1);
+        eytzinger_block = parlay::sequence<size_t>(first_keys.size() + 1);
+        FillEytzinger(0, 1);
+    }
+
+    /**
+     * Fill the subtree rooted at node k with the keys starting at block i by an in-order traversal
+     *
+     * @return The block after the last one in the subtree
+     */
+    size_t FillEytzinger(size_t i, size_t k) {
+        if (k <= first_keys.size()) {
+            i = FillEytzinger(i, 2 * k);
+            eytzinger[k] = first_keys[i];
+            eytzinger_block[k] = i++;
+            i = FillEytzinger(i, 2 * k + 1);
+        }
+        return i;
+    }
+
+    /**
+     * @return The first block whose first element is not less than the key, or the number of blocks if there is none
+     */
+    size_t FindBlock(const T &key) const {
+        size_t k = 1;
+        while (k <= first_keys.size()) {
+            k = 2 * k + comp(eytzinger[k], key);
+        }
+        // drop the right turns taken after the last left turn; the node where that happened holds the answer
+        k >>= __builtin_ffsl((long) ~k);
+        return k == 0 ? first_keys.size() : eytzinger_block[k];
+    }
+
+    /**
+     * @return Global position of the first element of a block, or the number of elements for the end of the dataset
+     */
+    [[nodiscard]] size_t GetBlockStart(size_t block) const {
+        if (block == first_keys.size()) {
+            return files.empty() ? 0 : (files.back().before_size + files.back().true_size) / sizeof(T);
+        }
+        size_t file = std::upper_bound(file_first_block.begin(), file_first_block.end(), block)
+                      - file_first_block.begin() - 1;
+        return files[file].before_size / sizeof(T) + (block - file_first_block[file]) * block_elements;
+    }
+
+    [[nodiscard]] size_t GetBlockSize(size_t block) const {
+        size_t file = std::upper_bound(file_first_block.begin(), file_first_block.end(), block)
+                      - file_first_block.begin() - 1;
+        size_t start = (block - file_first_block[file]) * block_elements;
+        return std::min(block_elements, files[file].true_size / sizeof(T) - start);
+    }
+};
+
+#endif //SORTING_SPARSE_INDEX_H
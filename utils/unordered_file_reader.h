@@ -19,6 +19,7 @@
 #include <utility>
 #include <iostream>
 #include <map>
+#include <atomic>
 #include <fcntl.h>
 
 struct UnorderedReaderConfig {
@@ -43,8 +44,9 @@ struct UnorderedReaderConfig {
 };
 
 /**
- * Read a list of files in no particular order. File sizes are assumed to be multiples of O_DIRECT_MULTIPLE and
- * all bytes in the file are plain data (no end-of-file size markers are used and there are not padding bytes).
+ * Read a list of files in no particular order. File sizes are assumed to be multiples of O_DIRECT_MULTIPLE.
+ * Only the first true_size bytes of each file are handed out, so files ending with padding and an end-of-file
+ * size marker (e.g. those created by the OrderedFileWriter) can be read as long as their true size is known.
  *
  * @tparam T The data type to be read from the file.
  */
@@ -124,15 +126,28 @@ public:
     explicit UnorderedFileReader() = default;
 
     ~UnorderedFileReader() {
-        is_open = false;
+        Cancel();
         Wait();
     }
 
+    /**
+     * Read all files beginning with the prefix. The files are treated as plain data without end-of-file markers.
+     */
     void PrepFiles(const std::string &prefix) {
         files = FindFiles(prefix);
+        GetFileInfo(files);
     }
 
+    /**
+     * @param file_list true_size must be populated (see GetFileInfo). Since only the first true_size bytes are read,
+     *   a list straight from FindFiles would silently read nothing. A file with an end marker and no data takes up a
+     *   single block, so a zero true size is only accepted for files no larger than that.
+     */
     void PrepFiles(const std::vector<FileInfo> &file_list) {
+        for (const auto &file: file_list) {
+            CHECK(file.true_size > 0 || file.file_size <= O_DIRECT_MULTIPLE)
+                    << "True size of " << file.file_name << " is not determined; call GetFileInfo first";
+        }
         this->files = file_list;
     }
 
@@ -182,6 +197,33 @@ public:
         buffer_queue.Close();
     }
 
+    /**
+     * Stop reading early. Workers stop issuing reads, wait for the reads that are already in flight and return their
+     * buffers to the allocator. Buffers that are queued but not yet polled are freed as well, so Poll returns nullptr
+     * once the caller's current buffers are handed back.
+     *
+     * This function is thread-safe and may be called by a thread that is polling; only the first call does any work.
+     * Buffers that were already polled still belong to the caller and must be freed as usual.
+     */
+    void Cancel() {
+        if (!is_open.exchange(false)) {
+            return;
+        }
+        buffer_queue.Close();
+        // free what is queued so that workers blocked on a full queue can make progress, then drain again after they
+        // are gone to pick up whatever they pushed before noticing the cancellation
+        DiscardQueued();
+        Wait();
+        DiscardQueued();
+    }
+
+    /**
+     * @return false once the reader has been cancelled
+     */
+    bool IsOpen() const {
+        return is_open;
+    }
+
     /**
      * Block until file reader finishes
      */
@@ -208,8 +250,8 @@ public:
     }
 
 private:
-    // whether the file reader is actively running
-    bool is_open = true;
+    // whether the file reader is actively running; cleared by Cancel and read by the worker threads
+    std::atomic<bool> is_open = true;
     std::atomic<int> active_threads = 0;
     // list of files to read
     std::vector<FileInfo> files;
@@ -228,21 +270,22 @@ private:
         size_t bytes_issued = 0;        // next file offset to consider for issue
         size_t chunks_active = 0;       // total chunks we plan to actually read
         size_t chunks_completed = 0;    // active chunks whose CQE has been reaped
-        size_t file_size;
+        size_t file_size;               // number of bytes to read (aligned)
+        size_t true_size;               // number of bytes that are actual data
         const size_t file_index;
         // Optional per-file bitmap: bit i set => chunk i should be read.
         // If null, every chunk is active.
         const uint64_t* active_bits = nullptr;
         size_t active_bits_words = 0;
 
-        OpenedFile(const std::string &name, size_t file_size, size_t file_index)
-                : file_size(file_size), file_index(file_index) {
+        OpenedFile(const std::string &name, size_t file_size, size_t true_size, size_t file_index)
+                : file_size(std::min(file_size, AlignUp(true_size))), true_size(true_size), file_index(file_index) {
             fd = open(name.c_str(), O_DIRECT | O_RDONLY);
             SYSCALL(fd);
         }
 
         explicit OpenedFile(const FileInfo &info)
-                : OpenedFile(info.file_name, info.file_size, info.file_index) {
+                : OpenedFile(info.file_name, info.file_size, info.true_size, info.file_index) {
         }
 
         ~OpenedFile() {
@@ -273,6 +316,16 @@ private:
         }
     };
 
+    void DiscardQueued() {
+        while (true) {
+            auto [data, code] = buffer_queue.Poll(BufferData(nullptr, 0, 0, 0), 0);
+            if (code != QueueCode::SUCCESS) {
+                break;
+            }
+            allocator.Free(std::get<0>(data));
+        }
+    }
+
     struct ReadRequest {
         size_t offset, read_size;
         OpenedFile *file;
@@ -289,8 +342,11 @@ private:
 
         std::deque<OpenedFile *> available_files;
         std::vector<OpenedFile *> completed_files;
+        // owns every opened file, including the ones left unfinished by a cancellation
+        std::vector<std::unique_ptr<OpenedFile>> opened_files;
         for (auto &file: all_files) {
             auto *f = new OpenedFile(file);
+            opened_files.emplace_back(f);
             if (active_chunks_per_file != nullptr &&
                 file.file_index < active_chunks_per_file->size()) {
                 const auto &bits = (*active_chunks_per_file)[file.file_index];
@@ -335,11 +391,16 @@ private:
                     // process this cqe
                     SYSCALL(cqe->res);
                     auto *request = (ReadRequest *) io_uring_cqe_get_data(cqe);
-                    // add data to buffer queue
-                    reader->Push(request->data, request->read_size / sizeof(T),
-                                 request->file->file_index,
-                                 request->offset / sizeof(T));
                     auto *file = request->file;
+                    // add data to buffer queue, excluding padding at the end of the file
+                    size_t data_size = std::min(request->read_size, file->true_size - request->offset);
+                    if (data_size >= sizeof(T) && reader->is_open) {
+                        reader->Push(request->data, data_size / sizeof(T),
+                                     file->file_index,
+                                     request->offset / sizeof(T));
+                    } else {
+                        reader->allocator.Free(request->data);
+                    }
                     file->chunks_completed++;
                     if (file->chunks_completed == file->chunks_active) {
                         completed_files.push_back(file);
@@ -393,17 +454,23 @@ private:
                 outstanding_requests++;
             }
         }
+        // after a cancellation, the kernel may still be writing to buffers of reads in flight
+        while (outstanding_requests > 0) {
+            struct io_uring_cqe *cqe;
+            SYSCALL(io_uring_wait_cqe(&ring, &cqe));
+            auto *request = (ReadRequest *) io_uring_cqe_get_data(cqe);
+            reader->allocator.Free(request->data);
+            outstanding_requests--;
+            io_uring_cqe_seen(&ring, cqe);
+        }
         // cleanup
         io_uring_queue_exit(&ring);
 
         free(request_pool);
-        CHECK(completed_files.size() == all_files.size())
+        CHECK(!reader->is_open || completed_files.size() == all_files.size())
                         << "Expected all files to be read when reader thread terminates: "
                         << all_files.size() << " files total, yet "
                         << completed_files.size() << " files are completed.";
-        for (auto &file: completed_files) {
-            delete file;
-        }
 
         reader->active_threads--;
         if (reader->active_threads == 0) {